@@ -21,10 +21,24 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <SDL.h>
 #include <SDL_image.h>
 #include <SDL_gfxPrimitives.h>
@@ -43,14 +57,95 @@
 #define PINKY 1
 #define INKY 2
 #define CLYDE 3
+#define MAZE_HEIGHT 53
+#define MAZE_WIDTH 46
+#define MAZE_MAX_POWERS 8
+#define MAZE_MAX_DOORS 4
+#define BLOB_MAGIC "PUCKMAZ"
+#define BLOB_VERSION 4
+#define BLOB_ALIGN 8
+#define NAV_PACMAN 0
+#define NAV_GHOST 1
+#define NAV_EYES 2
+#define NAV_LEFT_IN 16
+#define NAV_UP_IN 32
+#define NAV_MAX_NODES 128
+#define NAV_FAR 0xFFFF
+#define NAV_NEAR_FAR 0xFF
+#define COLLISION_REACH 20
+#define PINKY_AHEAD 40
+#define FIXED_SHIFT 8
+#define FIXED_ONE (1 << FIXED_SHIFT)
+#define SPEED_PACMAN 0
+#define SPEED_GHOST 1
+#define SPEED_FRIGHTENED 2
+#define SPEED_TUNNEL 3
+#define SPEED_EYES 4
+#define FLASH_FRAMES 72
+#define FRIGHT_FRAMES 120
+#define DEATH_FRAMES 12
+#define FRUIT_FRAMES 240
+#define REPLAY_MAGIC "PUCKREP"
+#define REPLAY_VERSION 2
+#define REPLAY_PAUSE 4
+#define REPLAY_INTERVAL 1024
+#define SAVE_MAGIC "PUCKSAV"
+#define SAVE_VERSION 1
+#define SCORE_MAGIC "PUCKSCO"
+#define SCORE_VERSION 1
+#define SCORES 10
+#define BOARD_PERSIST 5000
+#define WRITER_QUEUE 64
+#define RANK_MAGIC "PUCKRNK"
+#define RANK_VERSION 1
+#define RANK_NONE 0xFFFFFFFF
+#define RANK_DEPTH 64
+#define RANK_COMPACT 4096
+#define ASSET_SLOTS 512
+#define ASSET_NAME 20
+#define ARCHIVE_MAGIC "PUCKIMG"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_MAX 512
+#define LOADER_MAX 256
+#define LOADER_WORKERS 4
+#define LOADER_MAX_WORKERS 16
+#define BUNDLES 4
+#define BUNDLE_TITLE 0
+#define BUNDLE_MENU 1
+#define BUNDLE_GAME 2
+#define BUNDLE_SCORES 3
+#define BUNDLE_IMAGES 160
+#define BUNDLE_BUDGET (2 << 20)
+#define HASH_MAGIC "PUCKHSH"
+#define HASH_FIELDS 7
+#define HASH_PELLETS 0
+#define HASH_PACMAN 1
+#define HASH_GHOSTS 2
+#define HASH_GAME 6
+#define FOOD_BYTES ((MAZE_HEIGHT * MAZE_WIDTH + 31) / 32 * 4)
+#define CONTROLLER_KEEP -1
+#define CONTROLLER_GRACE 50
+#define BOT_LOOKAHEAD 6
+#define BOT_FAR 8
+#define CHECK_FRAMES 20000
+#define CHECK_STALL 10
+#define GYM_RESET 0
+#define GYM_STEP 1
+#define GYM_CLOSE 2
 
-typedef struct Ghost {
-  int x, y, dir, image_index, id, state, ways[4], initloop, lowspeed;
-  SDL_Surface *image[4][2], *scared[2], *scared2[8], *eyes[4];
-  struct Ghost *next;
-} Ghost;
+typedef struct Ghosts {
+  // one slot per ghost, indexed by id; the fields every tick touches come first
+  int x[4], y[4], dir[4], state[4], ways[4][4], initloop[4];
+  // speed and sub-pixel progress in 1/FIXED_ONE pixels per tick, whole pixels left this tick
+  int speed[4], sub[4], steps[4];
+  int image_index[4];
+  SDL_Surface *image[4][4][2];
+  // frightened, flashing and eyes frames, the same for every ghost
+  SDL_Surface *scared[2], *scared2[8], *eyes[4];
+} Ghosts;
 typedef struct Pacman {
   int x, y, dir, nextDir, image_index, stuck;
+  int speed, sub;
   SDL_Surface *image[4][4], *dead[12];
 } Pacman;
 typedef struct ImageData {
@@ -58,21 +153,354 @@ typedef struct ImageData {
   SDL_Surface *level, *getready, *gameover, *paused, *lives, *score;
   SDL_Surface *bonus100, *bonus200, *bonus300, *bonus400, *bonus500, *bonus700, *bonus800, *bonus1600;
   SDL_Surface *logo, *anim[39], *legal, *notice, *playgame[2], *highscores[2], *rules[2], *quitgame[2], *back, *rules_main, *enter;
+  SDL_Surface *letters[26];
 } ImageData;
+// packed images: the header, the entries sorted by name, then the image files as they are on disk
+typedef struct ArchiveHeader {
+  char magic[8];
+  Uint32 version, size, entries;
+} ArchiveHeader;
+typedef struct ArchiveEntry {
+  char name[ASSET_NAME];
+  Uint32 offset, size;
+} ArchiveEntry;
+// images decoded ahead by a pool of threads, in the order the game asks for them; image is
+// set once done is, all under lock
+typedef struct Loader {
+  char name[LOADER_MAX][ASSET_NAME];
+  SDL_Surface *image[LOADER_MAX];
+  int done[LOADER_MAX], taken[LOADER_MAX];
+  // 1 while the names are being gathered, next name to decode
+  int recording, count, next, workers;
+  SDL_mutex *lock, *gif;
+  SDL_cond *ready;
+  SDL_Thread *thread[LOADER_MAX_WORKERS];
+} Loader;
+// loaded image, shared by everything that asked for it by name and freed when the last of them lets go
+typedef struct Asset {
+  char name[ASSET_NAME];
+  SDL_Surface *image;
+  int refs;
+} Asset;
+// images one screen draws from, loaded the first time it shows and put back whole when evicted
+typedef struct Bundle {
+  SDL_Surface *image[BUNDLE_IMAGES];
+  int count, loaded;
+  // bytes of pixels held, an image shared with another bundle counting in both; ticks when last shown
+  Uint32 size, used;
+} Bundle;
+typedef struct Maze {
+  // pristine tiles, copied over game->walls when a level starts: -1 wall, 0 empty, 1 pellet
+  Sint8 walls[MAZE_HEIGHT][MAZE_WIDTH];
+  // power pellet tiles, and for each of them the tile and where its sprite is drawn
+  Uint8 power[MAZE_HEIGHT][MAZE_WIDTH];
+  int powers, sprite[MAZE_MAX_POWERS][4];
+  // where the pellets of each column and row are drawn, -1 for none
+  int column[MAZE_WIDTH], row[MAZE_HEIGHT];
+  // rows whose sides wrap around, with the leftmost and rightmost x on them and the x a wrap to the right
+  // side lands on, -1 for none, and the x left and right of which ghosts slow down in them
+  Uint8 tunnel[MAZE_HEIGHT];
+  int wrap[3], slow[2];
+  // tiles from which ghosts leave the house upward, tile above the door, tile the paths are numbered from
+  int doors, door[MAZE_MAX_DOORS][2], home[2], start[2];
+  // 1 to draw the hand-made classic outline rather than the tile edges
+  int outline;
+} Maze;
+typedef struct Nav {
+  // exits[kind][Y][X]: bit (1 << dir) for a move from the tile-aligned position,
+  // NAV_LEFT_IN and NAV_UP_IN for a move inside the tile
+  Uint8 exits[3][MAZE_HEIGHT][MAZE_WIDTH];
+  // junctions of the ghost graph and, for each exit, the next junction and the corridor length in tiles
+  int nodes, node[NAV_MAX_NODES][2], segment[NAV_MAX_NODES][4][2], node_index[MAZE_HEIGHT][MAZE_WIDTH];
+  // distances in tiles toward the ghost house
+  Uint16 home[MAZE_HEIGHT][MAZE_WIDTH];
+  // all-pairs table over the tiles reachable along the ghost exits, taken along those same exits:
+  // distance[a * tiles + b] and the first move from a toward b. Distances are bytes: a path of NAV_NEAR_FAR
+  // tiles or more reads as no path at all, where the longest in the mazes shipped is 85;
+  // tile list, distance and hop are byte offsets into game->tables, so that a Nav holds no pointer
+  int tiles, tile_index[MAZE_HEIGHT][MAZE_WIDTH];
+  Uint32 tile, distance, hop;
+  // walkable tile closest to each cell, for targets off the paths
+  int nearest[MAZE_HEIGHT][MAZE_WIDTH];
+  // index of the maze the tables were built for, -1 for none
+  int maze;
+} Nav;
+// compiled maze blob: the header, one entry per maze, then the Maze array, the Nav array and,
+// for each maze, its tile list, distance and hop tables and background pixels, at the given offsets
+typedef struct BlobHeader {
+  char magic[8];
+  Uint32 version, size, mazes, maze_size, nav_size, maze, nav;
+} BlobHeader;
+typedef struct BlobEntry {
+  Uint32 background, width, height, pitch;
+} BlobEntry;
+typedef struct Collision {
+  // positions at the previous tick, Pac-Man first then the ghosts by id
+  int from[5][2];
+  // ghosts touched since the last Game_process; the tick stops at the first contact, so their states
+  // are still those they were touched in when it settles them
+  int hits;
+  int hit[4];
+} Collision;
+// game state as it stands once the input of a frame is in, without the pointers nor what is derived from the level
+typedef struct Snapshot {
+  Uint32 frame, ticks, ticks_fruit;
+  int score, lives, level, state, bonus, newlife, paused, fruit, delay, candy_blow_delay;
+  Sint8 walls[MAZE_HEIGHT][MAZE_WIDTH];
+  // Pac-Man and the ghosts up to their images
+  char pacman[offsetof(struct Pacman, image)], ghosts[offsetof(struct Ghosts, image)];
+  Collision collision;
+} Snapshot;
+// hash stream: the header then one record per frame, the state hashed field by field
+typedef struct HashHeader {
+  char magic[8];
+  Uint32 fields;
+} HashHeader;
+typedef struct HashRecord {
+  Uint32 frame, pad;
+  Uint64 field[HASH_FIELDS];
+} HashRecord;
+// high score file: the header, then the SCORES entries best first; checksum is FNV-1a over the entries
+typedef struct ScoreHeader {
+  char magic[8];
+  Uint32 version, entries, checksum;
+} ScoreHeader;
+typedef struct Score {
+  // capital letters and spaces
+  char name[20];
+  Uint32 score;
+} Score;
+// log of every score ever posted: the header, then Score records, the first sorted of them in rank order
+typedef struct RankHeader {
+  char magic[8];
+  Uint32 version, sorted;
+} RankHeader;
+// node i stands for record i of the log; size counts the nodes of its subtree
+typedef struct RankNode {
+  Uint32 score, size, left, right;
+} RankNode;
+// the records in a tree ordered best first, then oldest first, kept within a depth of log 3/2 of
+// count by rebuilding the subtree that got too lopsided
+typedef struct Ranking {
+  RankNode *node;
+  Uint32 count, capacity, root, sorted;
+  int fd;
+  ino_t inode;
+  char *path;
+} Ranking;
+// high score table shared by every instance of a user in a shared memory segment; writers hold
+// flock on it and make sequence odd while they change the scores, readers copy them until they
+// see the same even sequence before and after
+typedef struct Board {
+  char magic[8];
+  Uint32 version, sequence, saved;
+  Score scores[SCORES];
+} Board;
+// disk writes of the high scores, done by a thread of their own: the scores posted since it last
+// woke up go into the log and the board at once, and the file is written once for any number of
+// persist requests
+typedef struct Writer {
+  Score pending[WRITER_QUEUE];
+  int count, persist, running;
+  SDL_mutex *lock;
+  SDL_cond *wake;
+  SDL_Thread *thread;
+} Writer;
+// save file: the header then the snapshot
+typedef struct SaveHeader {
+  char magic[8];
+  Uint32 version, mazes, snapshot_size;
+} SaveHeader;
+// replay file: the header, then the input of the frames with a keyframe snapshot after every
+// REPLAY_INTERVAL of them, then the keyframe index and the footer; the input of a frame is a byte holding the
+// direction in the low bits and REPLAY_PAUSE when pause was toggled, stored as runs of that byte and
+// their length as a varint
+typedef struct ReplayHeader {
+  char magic[8];
+  Uint32 version, mazes, interval, snapshot_size;
+} ReplayHeader;
+typedef struct ReplayKey {
+  Uint32 frame, offset;
+} ReplayKey;
+typedef struct ReplayFooter {
+  Uint32 index, keys, frames;
+} ReplayFooter;
+typedef struct Replay {
+  // written through file, read back from map
+  FILE *file;
+  Uint8 *map;
+  size_t map_size;
+  // 1 while writing the game being played, 0 while reading one back
+  int recording;
+  // 1 when pause was toggled since the last frame written
+  int paused;
+  Uint32 frames;
+  // current run: its input byte and the frames left in it (written so far while recording)
+  int run;
+  Uint32 left;
+  // keyframes, grown while recording and mapped while playing back
+  ReplayKey *keys;
+  Uint32 key_count, key_size;
+  // while playing back: next byte of the run stream, end of the current segment, next segment
+  // (segment k runs from keyframe k - 1, or the header, to keyframe k, or the index)
+  Uint32 pos, end, segment, index;
+} Replay;
+// source of Pac-Man's moves, asked once a frame before the game advances; view is the game as it
+// stands, which it only reads, and the answer a direction or CONTROLLER_KEEP
+typedef struct Controller {
+  int (*next)(struct Controller *controller, const struct GameData *view);
+  // script: the frames it changes direction at and the direction from each on, the next of them
+  Uint32 *frame;
+  Uint8 *dir;
+  Uint32 count, index;
+  // bot: random state for its whims
+  Uint32 seed;
+  // process: the pipes to its standard input and from its standard output, -1 when closed, and
+  // the answers it still owes for frames that went on without them
+  int in, out, late;
+  pid_t pid;
+} Controller;
+// game as sent to a controller process every frame, followed by its answer byte; food has one bit per
+// tile still holding a pellet, row by row, in whole 32-bit words so that there is no padding
+typedef struct Observation {
+  Uint32 frame;
+  Sint32 score, lives, level, state, pellets;
+  // x, y, dir, then x, y, dir, state of each ghost by id
+  Sint32 pacman[3], ghosts[4][4];
+  Uint8 food[FOOD_BYTES];
+} Observation;
+// environment server protocol: a client sends requests and gets a reply to each but close; step
+// plays action, a direction or anything else to keep it, for frames frames (1 for 0) or until game over
+typedef struct GymRequest {
+  Uint8 op, action;
+  Uint16 frames;
+} GymRequest;
+// reward is the score gained by the step, done 1 once the game is over; the observation carries
+// the lives, level and pellets left
+typedef struct GymReply {
+  Sint32 reward, done;
+  Observation observation;
+} GymReply;
 typedef struct GameData {
-  int running, speed, delay, walls[53][46], score, candy_index, candy_blow_delay, lives, level, state, bonus, newlife, paused, fruit, anim_index, selected, newscorer_index;
+  Sint8 walls[MAZE_HEIGHT][MAZE_WIDTH];
+  int running, delay, score, candy_index, candy_blow_delay, lives, level, state, bonus, newlife, paused, fruit, anim_index, selected, newscorer_index;
   SDL_Surface *screen;
-  clock_t ticks, ticks_fruit;
+  // frames since Game_new, and the frames Pac-Man last ate a power pellet and the fruit last showed or hid at
+  Uint32 frame, ticks, ticks_fruit;
   ImageData *img;
-  char highscores[2][11][20];
+  // the table, then the entry being typed in
+  Score scores[SCORES + 1];
+  // table shared with the other instances, or private to this one if board_fd is -1; sequence scores
+  // were copied at, ticks when last persisted
+  Board *board;
+  // every score, NULL if its log could not be opened
+  Ranking *ranking;
+  // thread writing the scores, NULL before Game_init and after shutdown
+  Writer *writer;
+  int board_fd;
+  Uint32 board_sequence, board_persisted;
   Pacman *pacman;
-  Ghost *ghosts;
+  Ghosts *ghosts;
+  Maze *mazes, *maze;
+  int maze_count;
+  // one Nav per maze when they come from the blob, mapped read-only at blob
+  Nav *nav, *navs;
+  char *blob;
+  size_t blob_size;
+  // what the Nav table offsets are from: the blob, or the block Nav_paths allocated
+  Uint8 *tables;
+  // image archive mapped at archive, NULL to read the image files one by one
+  char *archive;
+  size_t archive_size;
+  // decoding threads while a bundle loads, NULL otherwise, and how many of them to start
+  Loader *loader;
+  int workers;
+  // bundle being loaded, which takes a reference on every image asked for
+  Bundle *bundle;
+  // 1 when timing startup, nanoseconds at the start of main and at the last step
+  int bench;
+  Uint64 bench_start, bench_last;
+  SDL_Surface *background;
+  // distances in tiles toward chase_tile, the tile Pac-Man was on when they were worked out, -1 for none yet:
+  // only frightened ghosts read them, so they are only worked out when one does
+  Uint16 chase[MAZE_HEIGHT][MAZE_WIDTH];
+  int chase_tile;
+  Collision *collision;
   char* scores_file;
+  char* replay_file;
+  char* save_file;
+  Replay *replay;
+  // where Pac-Man's moves come from
+  Controller *controller;
+  // 1 to run the game logic alone, without rendering or delays
+  int headless;
+  // Zobrist hash of the pellets left, kept up to date as they are eaten, with one bit per tile
+  // holding one, row by row, and their count
+  Uint64 pellets;
+  Uint8 food[FOOD_BYTES];
+  int food_count;
+  // where the hash of every frame goes, NULL for nowhere
+  FILE *hashes;
 } GameData;
+// ghost targeting rules: where Ghost_steer heads for, 0 to wander
+struct Blinky {
+  static int target(int g, int *x, int *y);
+};
+struct Pinky {
+  static int target(int g, int *x, int *y);
+};
+struct Inky {
+  static int target(int g, int *x, int *y);
+};
+struct Clyde {
+  static int target(int g, int *x, int *y);
+};
+struct Home {
+  static int target(int g, int *x, int *y);
+};
 
-void Blinky_chase(Ghost *ghost);
+int Archive_check(const char *base, size_t size, const char *path);
+int Archive_compare(const void *a, const void *b);
+ArchiveEntry *Archive_find(const char *name);
+int Archive_open(const char *path);
+int Archive_write(const char *path);
+void Asset_free();
+SDL_Surface *Asset_get(const char *name);
+void Asset_put(SDL_Surface *image);
+void Bench_drop();
+void Bench_mark(const char *step);
+void Blob_background(int i);
+int Blob_check(const char *base, size_t size, const char *path);
+int Blob_fits(Uint32 offset, Uint64 length, Uint32 size);
+int Blob_open(const char *path);
+int Blob_pad(FILE *f, Uint32 offset);
+int Blob_write(const char *path);
+void Board_begin();
+void Board_close();
+Uint32 Board_copy(Score *scores);
+void Board_end();
+void Board_open();
+void Board_persist(int force);
+void Board_read();
+void Board_save();
+void Bundle_evict(int b);
+void Bundle_load(int b);
+int Bundle_screen();
+void Bundle_use(int mask);
+int Check_bot(int maze);
+int Check_paths(int maze);
+int Check_run(const char *dir);
 int cleanUp(int err);
-void Clyde_chase(Ghost *ghost);
+int Collision_check();
+void Collision_reset();
+int Collision_swept(int x0, int y0, int x1, int y1);
+int Controller_bot(Controller *controller, const GameData *view);
+void Controller_close(Controller *controller);
+int Controller_keyboard(Controller *controller, const GameData *view);
+Controller *Controller_open(const char *kind, const char *arg);
+int Controller_process(Controller *controller, const GameData *view);
+int Controller_run(const char *kind, const char *arg, Uint32 frames);
+int Controller_script(Controller *controller, const GameData *view);
 void drawBonus(int x, int y);
 void drawBottom();
 void drawCandies();
@@ -87,74 +515,304 @@ void drawNumber(int score, int x, int y);
 void drawPower(int x, int y);
 void drawRules();
 void eraseScreen();
+void Game_advance();
+void Game_draw();
 void Game_init();
 void Game_new();
 void Game_process();
+int Game_speed(int kind);
+void Game_step();
+void Game_tick();
 SDL_Surface *getImage(char *str);
 SDL_Surface *getLetter(int letter);
-void Ghost_chase(Ghost *ghost);
-void Ghost_checkWay(Ghost *ghost);
+int Ghost_aim(int g, int x, int y);
+void Ghost_chase(int g);
+void Ghost_checkWay(int g);
 void Ghost_draw();
-void Ghost_goHome(Ghost *ghost);
-void Ghost_move();
-int Ghost_moveDown(Ghost *ghost);
-int Ghost_moveLeft(Ghost *ghost);
-int Ghost_moveRight(Ghost *ghost);
-int Ghost_moveUp(Ghost *ghost);
+int Ghost_flow(int g, Uint16 field[MAZE_HEIGHT][MAZE_WIDTH], int flee);
+int Ghost_follow(int g);
+int Ghost_forward(int g);
+int Ghost_glide(int g, int ahead, int coast[4]);
+int Ghost_greedy(int g, int x, int y);
+void Ghost_move(int ahead, int coast[4]);
+int Ghost_moveDown(int g);
+int Ghost_moveLeft(int g);
+int Ghost_moveRight(int g);
+int Ghost_moveUp(int g);
 void Ghost_init();
-void Ghost_load(Ghost *ghost);
-void Ghost_scare(Ghost *ghost, int s);
+void Ghost_load();
+void Ghost_rewind(int coast[4]);
+void Ghost_scare(int g, int s);
+int Ghost_speed(int g);
+template <typename Rule> void Ghost_steer(int g);
+void Ghost_turn(int g, int x, int y);
 void Ghost_unscare();
-void Image_init();
-void Inky_chase(Ghost *ghost);
+int Gym_bench(const char *path, Uint32 steps, int frames);
+int Gym_read(int fd, void *data, size_t size);
+void Gym_reset(GymReply *reply);
+int Gym_serve(const char *path);
+void Gym_step(GymReply *reply, int action, int frames);
+int Gym_write(int fd, const void *data, size_t size);
+int Hash_compare(const char *a, const char *b);
+void Hash_init();
+Uint64 Hash_mix(Uint64 h, Uint64 v);
+void Hash_pellets();
+void Hash_take(HashRecord *record);
+void Hash_write();
+SDL_Surface *Image_convert(SDL_Surface *image);
+void Image_free();
+void Image_load(int b);
+SDL_Surface *Image_read(const char *name);
+int Loader_run(void *data);
+void Loader_start(int workers, int b);
+void Loader_stop();
+SDL_Surface *Loader_take(const char *name);
+void Maze_draw();
+void Maze_free();
+int Maze_init(const char *dir);
+int Maze_load(Maze *maze, FILE *f);
+int Maze_power(int Y, int X, int vertical);
+void Maze_select();
+int Maze_tunnel(int y);
+void Nav_build();
+int Nav_canMove(int kind, int x, int y, int dir);
+int Nav_cell(const GameData *view, int tile);
+void Nav_chase();
+int Nav_clear(int Y, int X, int vertical);
+int Nav_dir(int exits);
+int Nav_distance(const GameData *view, int Y1, int X1, int Y2, int X2);
+void Nav_field(Uint16 field[MAZE_HEIGHT][MAZE_WIDTH], int kind, int Y, int X);
+void Nav_free();
+int Nav_hop(const GameData *view, int Y1, int X1, int Y2, int X2);
+int Nav_kind(int g);
+int Nav_nearest(const GameData *view, int x, int y);
+void Nav_paths(int *tile, int tiles);
+int Nav_reverse(int dir);
+void Nav_step(const Maze *maze, int *Y, int *X, int dir);
+int Nav_ways(int kind, int x, int y);
+void Observation_take(Observation *observation, const GameData *view);
 void Pacman_checkDir();
 void Pacman_draw();
-void Pacman_free();
+void Pacman_eat(int Y, int X);
 void Pacman_init();
 void Pacman_load();
 void Pacman_move();
-void Pinky_chase(Ghost *ghost);
 void raiseWalls();
-void sort();
-void swap(int i);
-int toInt(char score[20]);
-void writeScores();
+void Rank_add(const char *name, Uint32 score);
+Uint32 Rank_build(const Uint32 *ids, Uint32 lo, Uint32 hi);
+void Rank_close();
+void Rank_compact();
+Uint32 Rank_flatten(Uint32 i, Uint32 *ids);
+void Rank_grow(Uint32 n);
+void Rank_insert(Uint32 i);
+int Rank_load();
+Uint32 Rank_of(Uint32 score);
+int Rank_open(const char *path);
+void Rank_read(off_t size);
+int Rank_run(Uint32 count, const char *path);
+Uint32 Rank_select(Uint32 k);
+void Rank_sync();
+void Rank_view(Score *scores, Uint32 first, Uint32 n);
+void Replay_close();
+void Replay_flush();
+int Replay_input();
+void Replay_key();
+int Replay_next();
+int Replay_open(const char *path, int recording);
+int Replay_run(const char *path, Uint32 frame);
+int Replay_seek(Uint32 frame);
+void Replay_segment(Uint32 k);
+Uint32 Score_checksum(const Score *scores);
+void Score_load();
+void Score_post(const Score *batch, int n);
+void Score_write(const Score *scores);
+void Snapshot_load(const char *path);
+void Snapshot_restore(const Snapshot *snapshot);
+void Snapshot_save(const char *path);
+void Snapshot_take(Snapshot *snapshot);
+void Writer_post(const char *name, Uint32 score);
+int Writer_run(void *data);
+void Writer_start();
+void Writer_stop();
 
 GameData *game;
+// speeds per level band (1, 2-4, 5-20, 21+) in 1/FIXED_ONE pixels per tick:
+// Pac-Man, ghosts, frightened ghosts, ghosts in the tunnel, eyes
+int speeds[4][5] = {
+  { 1792, 1680, 1120, 896, 3584 },
+  { 2016, 1904, 1232, 1008, 3584 },
+  { 2240, 2128, 1344, 1120, 3584 },
+  { 2016, 2128, 1344, 1120, 3584 }
+};
+// one random key per tile, drawn from a fixed seed so that hashes match across runs and builds
+Uint64 zobrist[MAZE_HEIGHT][MAZE_WIDTH];
+// images by name, open addressing on the hash of the name
+Asset assets[ASSET_SLOTS];
+#ifdef EMBED_IMAGES
+// images.bin and mazes.bin as byte arrays, generated by make images.c and mazes.c
+extern const unsigned char images_bin[];
+extern const unsigned int images_bin_len;
+extern const unsigned char mazes_bin[];
+extern const unsigned int mazes_bin_len;
+#endif
+Bundle bundles[BUNDLES];
+const char *Hash_names[HASH_FIELDS] = { "pellets", "pacman", "blinky", "pinky", "inky", "clyde", "game" };
 
 int main (int argc, char **argv) {
   game = (GameData *) malloc(sizeof(struct GameData));
   ImageData *image = (ImageData *) malloc(sizeof(struct ImageData));
   Pacman *pacman = (Pacman *) malloc(sizeof(struct Pacman));
-  Ghost *blinky = (Ghost *) malloc(sizeof(struct Ghost));
-  Ghost *pinky = (Ghost *) malloc(sizeof(struct Ghost));
-  Ghost *inky = (Ghost *) malloc(sizeof(struct Ghost));
-  Ghost *clyde = (Ghost *) malloc(sizeof(struct Ghost));
+  Ghosts *ghosts = (Ghosts *) malloc(sizeof(struct Ghosts));
+  Nav *nav = (Nav *) malloc(sizeof(struct Nav));
+  nav->maze = -1;
+  game->navs = NULL;
+  game->blob = NULL;
+  game->tables = NULL;
+  game->archive = NULL;
+  game->loader = NULL;
+  game->bundle = NULL;
+  game->writer = NULL;
+  game->controller = NULL;
+  game->background = NULL;
+  Collision *collision = (Collision *) malloc(sizeof(struct Collision));
+  collision->hits = 0;
   game->img = image;
+  game->nav = nav;
+  game->collision = collision;
+  // puckman -c mazes.bin compiles mazes/ into a blob and quits
+  if (argc == 3 && strcmp(argv[1], "-c") == 0)
+    return Blob_write(argv[2]);
+  // puckman -a images.bin packs images/ into an archive and quits
+  if (argc == 3 && strcmp(argv[1], "-a") == 0)
+    return Archive_write(argv[2]);
+  // puckman -D a b tells the first frame and field two hash streams differ at
+  if (argc == 4 && strcmp(argv[1], "-D") == 0)
+    return Hash_compare(argv[2], argv[3]);
+  // puckman -s count log fills a fresh score log with count random scores and times the ranking on it
+  if (argc == 4 && strcmp(argv[1], "-s") == 0)
+    return Rank_run(strtoul(argv[2], NULL, 10), argv[3]);
+  // puckman -G socket steps [frames] times steps random steps of frames frames against the environment
+  // server listening on socket
+  if ((argc == 4 || argc == 5) && strcmp(argv[1], "-G") == 0)
+    return Gym_bench(argv[2], strtoul(argv[3], NULL, 10), (argc == 5) ? atoi(argv[4]) : 1);
+  // puckman -b [cold] [workers] prints each startup step as: name, milliseconds it took, milliseconds since
+  // main, and quits once the first frame is on screen; cold drops the page cache first, workers is the
+  // number of threads decoding the images, LOADER_WORKERS otherwise
+  game->bench = argc >= 2 && argc <= 4 && strcmp(argv[1], "-b") == 0;
+  game->workers = LOADER_WORKERS;
+  if (game->bench == 1) {
+    int cold = argc >= 3 && strcmp(argv[2], "cold") == 0;
+    if (argc == 3 + cold)
+      game->workers = atoi(argv[2 + cold]);
+    printf("mode %s\nworkers %d\n", cold ? "cold" : "warm", game->workers);
+    if (cold)
+      Bench_drop();
+    Bench_mark(NULL);
+  }
+  Hash_init();
+  // no pellets, and their hash, until the first level raises the walls
+  memset(game->walls, 0, sizeof(game->walls));
+  Hash_pellets();
   game->pacman = pacman;
-  game->ghosts = blinky;
-  blinky->next = pinky;
-  pinky->next = inky;
-  inky->next = clyde;
-  clyde->next = blinky;
+  game->ghosts = ghosts;
+#ifdef EMBED_IMAGES
+  // images.bin linked in by make puckman-embedded, read in place without touching the disk
+  if (Archive_check((const char *) images_bin, images_bin_len, "embedded images") > 0)
+    game->archive = (char *) images_bin;
+#else
+  Archive_open(PACPATH "images.bin");
+#endif
+  Bench_mark("archive");
   Game_init();
-  Image_init();
+  Bench_mark("game_init");
+  // puckman -T mazes/ checks the paths of every maze of the given directory rather than the installed ones and
+  // plays the bot through it, then quits, failing if one maze did not pass
+  if (argc == 3 && strcmp(argv[1], "-T") == 0)
+    return cleanUp(Check_run(argv[2]));
+#ifdef EMBED_IMAGES
+  // mazes.bin linked in the same way, the maze files only read if it does not fit this version
+  if (Blob_check((const char *) mazes_bin, mazes_bin_len, "embedded mazes") == 0 && Maze_init(PACPATH "mazes/") == 0) {
+#else
+  if (Blob_open(PACPATH "mazes.bin") == 0 && Maze_init(PACPATH "mazes/") == 0) {
+#endif
+    fprintf(stderr, "Could not load any maze from %smazes/\n", PACPATH);
+    return 1;
+  }
+  Bench_mark("mazes");
   Pacman_init();
+  Bench_mark("pacman_init");
   Ghost_init();
+  Bench_mark("ghost_init");
+  // puckman -R replay [frame] runs a recorded game through the logic from its first frame as fast as it goes, up to the
+  // given frame or its end, and prints where it stands
+  if ((argc == 3 || argc == 4) && strcmp(argv[1], "-R") == 0)
+    return cleanUp(Replay_run(argv[2], argc == 4 ? strtoul(argv[3], NULL, 10) : 0xFFFFFFFF));
+  // puckman -P bot|script file|exec command [frames] plays a game with the given controller through the
+  // logic as fast as it goes, up to the given frame or game over, and prints where it ends
+  if (argc >= 3 && argc <= 5 && strcmp(argv[1], "-P") == 0) {
+    int args = (strcmp(argv[2], "bot") == 0) ? 3 : 4;
+    return cleanUp(Controller_run(argv[2], (args == 4) ? argv[3] : NULL, (argc > args) ? strtoul(argv[args], NULL, 10) : 0xFFFFFFFF));
+  }
+  // puckman -g socket serves games to one client at a time over a Unix domain socket, see GymRequest
+  if (argc == 3 && strcmp(argv[1], "-g") == 0)
+    return cleanUp(Gym_serve(argv[2]));
+  // puckman -H replay hashes does the same to its end and writes the hash of the game as it starts, then of
+  // every frame, to hashes
+  if (argc == 4 && strcmp(argv[1], "-H") == 0) {
+    HashHeader header;
+    if ((game->hashes = fopen(argv[3], "wb")) == NULL) {
+      printf("Cannot open file %s\n", argv[3]);
+      return cleanUp(1);
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HASH_MAGIC, 8);
+    header.fields = HASH_FIELDS;
+    fwrite(&header, sizeof(header), 1, game->hashes);
+    int err = Replay_run(argv[2], 0xFFFFFFFF);
+    fclose(game->hashes);
+    return cleanUp(err);
+  }
   SDL_Event event;
-  Uint8 *keystate;
+  int dir;
   if (SDL_Init(SDL_INIT_VIDEO != 0)) {
     fprintf(stderr, "Could not initialise SDL: %s\n", SDL_GetError());
     return 1;
   }
+  // SDL_image sets up its PNG decoder on first use, which is not safe from several loader threads at once
+  if ((IMG_Init(IMG_INIT_PNG) & IMG_INIT_PNG) == 0) {
+    fprintf(stderr, "Could not initialise SDL_image: %s\n", IMG_GetError());
+    return cleanUp(1);
+  }
+  Bench_mark("sdl_init");
   if ((game->screen = SDL_SetVideoMode(SCREEN_WIDTH, SCREEN_HEIGHT, 8, SDL_SWSURFACE)) == NULL) {
     fprintf(stderr, "Could not set SDL video mode: %s\n", SDL_GetError());
     return cleanUp(1);
   }
-  SDL_Rect dest = { 170, 290, 0, 0 };
+  Bench_mark("video_mode");
   SDL_WM_SetCaption("Puck-Man", "Puck-Man");
   SDL_ShowCursor(SDL_DISABLE);
+  // puckman -r replay [frame] plays it back on screen instead, from the given frame on; the first
+  // frame is sought as well so that the main loop's first step is that of a played frame
+  if ((argc == 3 || argc == 4) && strcmp(argv[1], "-r") == 0) {
+    if (Replay_open(argv[2], 0) == 0)
+      return cleanUp(1);
+    Game_new();
+    Uint32 frame = (argc == 4) ? strtoul(argv[3], NULL, 10) : 1;
+    if (Replay_seek((frame == 0) ? 1 : frame) == 0) {
+      fprintf(stderr, "%s ends before frame %u\n", argv[2], frame);
+      Replay_close();
+      return cleanUp(1);
+    }
+  }
+  // puckman -p bot|script file|exec command plays with the given controller rather than the keyboard
+  if ((argc == 3 || argc == 4) && strcmp(argv[1], "-p") == 0 && (game->controller = Controller_open(argv[2], argv[3])) == NULL)
+    return cleanUp(1);
+  if (game->controller == NULL)
+    game->controller = Controller_open("keys", NULL);
+  Bundle_use(Bundle_screen());
+  Bench_mark("images");
   while (1) {
+    Bundle_use(Bundle_screen());
     eraseScreen();
     if (game->state == 5) {
       --(game->anim_index);
@@ -173,58 +831,27 @@ int main (int argc, char **argv) {
     else if (game->state == 8)
       drawNewscorer();
     else {
-      Game_process();
-      if (game->state != 1) {
-        game->fruit = 0;
-        game->ticks_fruit = clock();
-      }
-      if (game->state == 0) {
-        ++(game->level);
-        raiseWalls();
-        Pacman_init();
-        Ghost_init();
-        SDL_BlitSurface(game->img->level, NULL, game->screen, &dest);
-        drawNumber(game->level, 260, 290);
-      }
-      else if (game->state == 4) {
-        --(game->lives);
-        Pacman_init();
-        Ghost_init();
-        if (game->lives < 1)
-          SDL_BlitSurface(game->img->gameover, NULL, game->screen, &dest);
-        else
-          SDL_BlitSurface(game->img->getready, NULL, game->screen, &dest);
-	if (game->lives == -2) {
-	  game->delay = 100;
-	  game->state = 8;
-	}
-      }
-      if (game->state == 1 && ((double) clock() - game->ticks_fruit) / CLOCKS_PER_SEC >= 0.5) {
-        game->fruit ^= 1;
-        game->ticks_fruit = clock();
-      }
-      if (game->fruit == 1)
-        drawFruit();
-      drawBottom();
-      drawMaze();
-      drawCandies();
-      Pacman_draw();
-      if (game->state != 2)
-        Ghost_draw();
-      if (game->paused == 1)
-        SDL_BlitSurface(game->img->paused, NULL, game->screen, &dest);
-      if (game->state == 3) {
-        game->score += game->bonus;
-        drawBonus(game->pacman->x, game->pacman->y - 10);
-        game->bonus = 0;
-      }
+      Game_step();
+      Game_draw();
     }
     SDL_UpdateRect(game->screen, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    if (game->bench == 1) {
+      Bench_mark("first_frame");
+      break;
+    }
     while (SDL_PollEvent(&event))
       if (event.type == SDL_QUIT || (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE))
         game->running = 0;
-      else if (game->state == 1 && event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_p)
-        game->paused ^= 1;
+      else if (game->state == 1 && event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_p && (game->replay == NULL || game->replay->recording == 1)) {
+        if (game->replay != NULL)
+          game->replay->paused ^= 1;
+        else
+          game->paused ^= 1;
+      }
+      else if (game->state == 1 && event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_s)
+        Snapshot_save(game->save_file);
+      else if (game->state == 1 && event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_l && (game->replay == NULL || game->replay->recording == 1))
+        Snapshot_load(game->save_file);
       else if (game->state == 5 && event.type == SDL_KEYDOWN) {
         if (event.key.keysym.sym == SDLK_UP)
 	  game->selected = (game->selected == 0) ? 0 : game->selected - 1;
@@ -234,6 +861,7 @@ int main (int argc, char **argv) {
 	  switch (game->selected) {
 	    case 0:
 	      Game_new();
+	      Replay_open(game->replay_file, 1);
 	      break;
 	    case 1:
 	      game->state = 7;
@@ -253,190 +881,1002 @@ int main (int argc, char **argv) {
       else if (game->state == 8 && event.type == SDL_KEYDOWN) {
         if (event.key.keysym.sym == SDLK_RETURN) {
 	  if (game->newscorer_index > 1) {
-	    snprintf(game->highscores[1][10], 20, "%d                    ", game->score);
-	    sort();
+	    Writer_post(game->scores[SCORES].name, game->score);
 	    game->state = 5;
 	  }
 	}
 	else if (event.key.keysym.sym >= SDLK_a && event.key.keysym.sym <= SDLK_z) {
 	  if (game->newscorer_index < 19)
-            game->highscores[0][10][game->newscorer_index] = event.key.keysym.sym - 32;
+            game->scores[SCORES].name[game->newscorer_index] = event.key.keysym.sym - 32;
 	  if (game->newscorer_index < 19)
 	    ++(game->newscorer_index);
 	}
 	else if (event.key.keysym.sym == SDLK_BACKSPACE && game->newscorer_index > 0) {
-	  game->highscores[0][10][game->newscorer_index - 1] = ' ';
+	  game->scores[SCORES].name[game->newscorer_index - 1] = ' ';
 	  --(game->newscorer_index);
 	}
       }
     if (game->running == 0)
       break;
-    if (game->state < 5) {
-      keystate = SDL_GetKeyState(NULL);
-      if (keystate[SDLK_RIGHT])
-        game->pacman->nextDir = RIGHT;
-      else if (keystate[SDLK_LEFT])
-        game->pacman->nextDir = LEFT;
-      else if (keystate[SDLK_UP])
-        game->pacman->nextDir = UP;
-      else if (keystate[SDLK_DOWN])
-        game->pacman->nextDir = DOWN;
-    }
-    if (game->paused == 1)
-      ;
-    else if (game->state == 0) {
-      SDL_Delay(1000);
-      game->state = 1;
-    }
-    else if (game->state == 1) {
-      int i = 0;
-      while (i < game->speed) {
-        Pacman_move();
-        Ghost_move();
-        ++i;
-      }
-    }
-    else if (game->state == 2) {
-      if (((double) clock() - game->ticks) / CLOCKS_PER_SEC >= 0.03)
-	game->state = 4;
-    }
-    else if (game->state == 3) {
-      SDL_Delay(300);
-      game->state = 1;
+    if (game->replay != NULL && game->replay->recording == 0) {
+      if (Replay_input() == 0)
+        break;
     }
-    else if (game->state == 4) {
-      SDL_Delay(1000);
-      if (game->lives > 0)
-        game->state = 1;
+    else if (game->state < 5 || game->state == 9) {
+      if ((dir = game->controller->next(game->controller, game)) != CONTROLLER_KEEP)
+        game->pacman->nextDir = dir;
+      Replay_input();
     }
-    else if (game->state == 9)
-      game->state = 0;
+    else if (game->replay != NULL)
+      Replay_close();
+    Board_persist(0);
+    Game_advance();
     SDL_Delay(game->delay);
   }
+  if (game->replay != NULL)
+    Replay_close();
+  Controller_close(game->controller);
+  Writer_stop();
+  Board_close();
+  Rank_close();
+  Image_free();
+  Asset_free();
+#ifndef EMBED_IMAGES
+  if (game->archive != NULL)
+    munmap(game->archive, game->archive_size);
+#endif
+  if (game->background != NULL)
+    SDL_FreeSurface(game->background);
+  game->nav = nav;
+  Nav_free();
+  free(nav);
+  Maze_free();
+  free(collision);
   free(game);
   free(image);
   free(pacman);
-  free(blinky);
-  free(pinky);
-  free(inky);
-  free(clyde);
+  free(ghosts);
   return cleanUp(0);
 }
-void Blinky_chase(Ghost *ghost) {
-  int x = game->pacman->x;
-  int y = game->pacman->y;
-  if (ghost->state == 1 || ghost->state == 2) {
-    x = 461 - x;
-    y = 580 - y;
-  }
-  if (x == ghost->x && y > ghost->y && ghost->ways[DOWN] == 1 && Ghost_moveDown(ghost) == 1)
-    ghost->dir = DOWN;
-  else if (y == ghost->y && x < ghost->x && ghost->ways[LEFT] == 1 && Ghost_moveLeft(ghost) == 1)
-    ghost->dir = LEFT;
-  else if (x == ghost->x && y < ghost->y && ghost->ways[UP] == 1 && Ghost_moveUp(ghost) == 1)
-    ghost->dir = UP;
-  else if (y == ghost->y && x > ghost->x && ghost->ways[RIGHT] == 1 && Ghost_moveRight(ghost) == 1)
-    ghost->dir = RIGHT;
-  else if (x > ghost->x && ghost->ways[RIGHT] == 1 && Ghost_moveRight(ghost) == 1)
-    ghost->dir = RIGHT;
-  else if (y > ghost->y && ghost->ways[DOWN] == 1 && Ghost_moveDown(ghost) == 1)
-    ghost->dir = DOWN;
-  else if (x < ghost->x && ghost->ways[LEFT] == 1 && Ghost_moveLeft(ghost) == 1)
-    ghost->dir = LEFT;
-  else if (y < ghost->y && ghost->ways[UP] == 1 && Ghost_moveUp(ghost) == 1)
-    ghost->dir = UP;
-  else if (ghost->dir == LEFT && Ghost_moveLeft(ghost) == 0) {
-    if (y >= ghost->y && ghost->ways[DOWN] == 1 && Ghost_moveDown(ghost) == 1)
-      ghost->dir = DOWN;
-    else if (ghost->ways[UP] == 1 && Ghost_moveUp(ghost) == 1)
-      ghost->dir = UP;
-    else {
-      ghost->dir = DOWN;
-      Ghost_moveDown(ghost);
+int Archive_check(const char *base, size_t size, const char *path) {
+  ArchiveHeader *header = (ArchiveHeader *) base;
+  ArchiveEntry *entry = (ArchiveEntry *) (base + sizeof(struct ArchiveHeader));
+  Uint32 i = 0;
+  int valid = size >= sizeof(struct ArchiveHeader) && memcmp(header->magic, ARCHIVE_MAGIC, 8) == 0 && header->version == ARCHIVE_VERSION && header->size == (Uint32) size && Blob_fits(sizeof(struct ArchiveHeader), (Uint64) header->entries * sizeof(struct ArchiveEntry), header->size);
+  while (valid && i < header->entries) {
+    valid = Blob_fits(entry[i].offset, entry[i].size, header->size) && entry[i].name[ASSET_NAME - 1] == '\0';
+    ++i;
+  }
+  if (valid == 0) {
+    printf("Ignoring %s: built for another version of puckman\n", path);
+    return 0;
+  }
+  return header->entries;
+}
+int Archive_compare(const void *a, const void *b) {
+  return strcmp(((const ArchiveEntry *) a)->name, ((const ArchiveEntry *) b)->name);
+}
+ArchiveEntry *Archive_find(const char *name) {
+  ArchiveEntry key;
+  if (game->archive == NULL || strlen(name) >= ASSET_NAME)
+    return NULL;
+  memset(key.name, 0, ASSET_NAME);
+  strcpy(key.name, name);
+  return (ArchiveEntry *) bsearch(&key, game->archive + sizeof(struct ArchiveHeader), ((ArchiveHeader *) game->archive)->entries, sizeof(struct ArchiveEntry), Archive_compare);
+}
+int Archive_open(const char *path) {
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return 0;
+  if (fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(struct ArchiveHeader)) {
+    close(fd);
+    return 0;
+  }
+  // one mapping for every image, decoded straight from the page cache
+  char *base = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+    return 0;
+  int entries = Archive_check(base, st.st_size, path);
+  if (entries == 0) {
+    munmap(base, st.st_size);
+    return 0;
+  }
+  game->archive = base;
+  game->archive_size = st.st_size;
+  return entries;
+}
+int Archive_write(const char *path) {
+  ArchiveHeader header;
+  ArchiveEntry *entry = (ArchiveEntry *) calloc(ARCHIVE_MAX, sizeof(struct ArchiveEntry));
+  DIR *dir = opendir("images/");
+  struct dirent *file;
+  int size = strlen(path) + 5, err = 0;
+  char *name = (char *) malloc((ASSET_NAME + 8) * sizeof(char)), *data = NULL, *tmp = (char *) malloc(size * sizeof(char));
+  Uint32 count = 0, i = 0, offset;
+  FILE *f = NULL, *in;
+  if (dir == NULL) {
+    fprintf(stderr, "Could not open images/\n");
+    err = 1;
+  }
+  while (err == 0 && (file = readdir(dir)) != NULL) {
+    size_t n = strlen(file->d_name);
+    if (n < ASSET_NAME && n > 4 && (strcmp(file->d_name + n - 4, ".gif") == 0 || strcmp(file->d_name + n - 4, ".png") == 0)) {
+      // an image left out would only show up as missing in the middle of a game
+      if (count == ARCHIVE_MAX) {
+        fprintf(stderr, "Could not pack images/: more than %d images\n", ARCHIVE_MAX);
+        err = 1;
+      }
+      else
+        strcpy(entry[count++].name, file->d_name);
     }
   }
-  else if (ghost->dir == DOWN && Ghost_moveDown(ghost) == 0) {
-    if (x >= ghost->x && ghost->ways[RIGHT] == 1 && Ghost_moveRight(ghost) == 1)
-      ghost->dir = RIGHT;
-    else if (ghost->ways[LEFT] == 1 && Ghost_moveLeft(ghost) == 1)
-      ghost->dir = LEFT;
+  if (dir != NULL)
+    closedir(dir);
+  qsort(entry, count, sizeof(struct ArchiveEntry), Archive_compare);
+  // written aside and renamed over the old archive once whole
+  snprintf(tmp, size, "%s.tmp", path);
+  if (err == 0 && (f = fopen(tmp, "wb")) == NULL) {
+    fprintf(stderr, "Could not write %s\n", tmp);
+    err = 1;
+  }
+  offset = sizeof(struct ArchiveHeader) + count * sizeof(struct ArchiveEntry);
+  if (err == 0)
+    Blob_pad(f, offset);
+  while (err == 0 && i < count) {
+    snprintf(name, ASSET_NAME + 8, "images/%s", entry[i].name);
+    if ((in = fopen(name, "rb")) == NULL || fseek(in, 0, SEEK_END) != 0) {
+      fprintf(stderr, "Could not read %s\n", name);
+      err = 1;
+    }
     else {
-      ghost->dir = RIGHT;
-      Ghost_moveRight(ghost);
+      offset = (ftell(f) + BLOB_ALIGN - 1) / BLOB_ALIGN * BLOB_ALIGN;
+      Blob_pad(f, offset);
+      entry[i].offset = offset;
+      entry[i].size = ftell(in);
+      data = (char *) realloc(data, entry[i].size);
+      rewind(in);
+      if (fread(data, 1, entry[i].size, in) != entry[i].size || fwrite(data, 1, entry[i].size, f) != entry[i].size) {
+        fprintf(stderr, "Could not copy %s\n", name);
+        err = 1;
+      }
     }
+    if (in != NULL)
+      fclose(in);
+    ++i;
   }
-  else if (ghost->dir == RIGHT && Ghost_moveRight(ghost) == 0) {
-    if (y >= ghost->y && ghost->ways[DOWN] && Ghost_moveDown(ghost) == 1)
-      ghost->dir = DOWN;
-    else if (ghost->ways[UP] == 1 && Ghost_moveUp(ghost) == 1)
-      ghost->dir = UP;
-    else {
-      ghost->dir = DOWN;
-      Ghost_moveDown(ghost);
+  if (err == 0) {
+    memset(&header, 0, sizeof(struct ArchiveHeader));
+    memcpy(header.magic, ARCHIVE_MAGIC, 8);
+    header.version = ARCHIVE_VERSION;
+    header.size = ftell(f);
+    header.entries = count;
+    rewind(f);
+    if (fwrite(&header, sizeof(struct ArchiveHeader), 1, f) != 1 || fwrite(entry, sizeof(struct ArchiveEntry), count, f) != count || fflush(f) != 0) {
+      fprintf(stderr, "Could not write %s\n", tmp);
+      err = 1;
+    }
+  }
+  if (f != NULL && fclose(f) != 0 && err == 0) {
+    fprintf(stderr, "Could not write %s\n", tmp);
+    err = 1;
+  }
+  if (err == 0 && rename(tmp, path) != 0) {
+    fprintf(stderr, "Could not write %s\n", path);
+    err = 1;
+  }
+  if (err == 0)
+    printf("%s: %u images, %u bytes\n", path, count, header.size);
+  else if (f != NULL)
+    remove(tmp);
+  free(data);
+  free(name);
+  free(tmp);
+  free(entry);
+  return err;
+}
+void Asset_free() {
+  int i = 0;
+  while (i < ASSET_SLOTS) {
+    if (assets[i].image != NULL)
+      SDL_FreeSurface(assets[i].image);
+    assets[i].image = NULL;
+    assets[i].name[0] = '\0';
+    assets[i++].refs = 0;
+  }
+}
+SDL_Surface *Asset_get(const char *name) {
+  Uint32 h = 2166136261u;
+  const char *c = name;
+  Loader *loader = game->loader;
+  Bundle *bundle = game->bundle;
+  while (*c != '\0')
+    h = (h ^ (Uint8) *c++) * 16777619u;
+  // slots only ever fill up, a free one ends the search
+  while (assets[h % ASSET_SLOTS].name[0] != '\0' && strcmp(assets[h % ASSET_SLOTS].name, name) != 0)
+    ++h;
+  Asset *asset = &assets[h % ASSET_SLOTS];
+  // while the loader gathers names, only queue the images not loaded yet
+  if (loader != NULL && loader->recording == 1) {
+    int i = 0;
+    while (i < loader->count && strcmp(loader->name[i], name) != 0)
+      ++i;
+    if (asset->image == NULL && i == loader->count && loader->count < LOADER_MAX && strlen(name) < ASSET_NAME)
+      strcpy(loader->name[loader->count++], name);
+    return NULL;
+  }
+  if (asset->name[0] == '\0')
+    snprintf(asset->name, ASSET_NAME, "%s", name);
+  if (asset->image == NULL)
+    asset->image = (loader != NULL) ? Loader_take(name) : getImage((char *) name);
+  if (asset->image == NULL)
+    return NULL;
+  ++(asset->refs);
+  if (bundle != NULL && bundle->count < BUNDLE_IMAGES) {
+    bundle->image[bundle->count++] = asset->image;
+    bundle->size += asset->image->pitch * asset->image->h;
+  }
+  return asset->image;
+}
+void Asset_put(SDL_Surface *image) {
+  int i = 0;
+  while (i < ASSET_SLOTS && (image == NULL || assets[i].image != image))
+    ++i;
+  if (i < ASSET_SLOTS && --(assets[i].refs) == 0) {
+    SDL_FreeSurface(assets[i].image);
+    assets[i].image = NULL;
+  }
+}
+void Bench_drop() {
+  const char *files[3] = { PACPATH "images.bin", PACPATH "mazes.bin", "/.puckman/highscores.dat" };
+  char path[256];
+  int i = 0, fd;
+  FILE *f;
+  sync();
+  // the whole page cache when allowed to, the files read at startup otherwise
+  if ((f = fopen("/proc/sys/vm/drop_caches", "w")) != NULL) {
+    fputs("3\n", f);
+    if (fclose(f) == 0) {
+      printf("cache dropped\n");
+      return;
+    }
+  }
+  while (i < 3) {
+    snprintf(path, sizeof(path), "%s%s", (i == 2) ? getenv("HOME") : "", files[i]);
+    if ((fd = open(path, O_RDONLY)) != -1) {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      close(fd);
     }
+    ++i;
+  }
+  printf("cache dropped files\n");
+}
+void Bench_mark(const char *step) {
+  struct timespec ts;
+  if (game->bench == 0)
+    return;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  Uint64 now = (Uint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+  if (step == NULL)
+    game->bench_start = now;
+  else
+    printf("%s %.3f %.3f\n", step, (now - game->bench_last) / 1e6, (now - game->bench_start) / 1e6);
+  game->bench_last = now;
+}
+int Blinky::target(int g, int *x, int *y) {
+  *x = game->pacman->x;
+  *y = game->pacman->y;
+  return 1;
+}
+void Blob_background(int i) {
+  BlobEntry *entry = (BlobEntry *) (game->blob + sizeof(struct BlobHeader)) + i;
+  SDL_Surface *pixels;
+  if (game->background != NULL)
+    SDL_FreeSurface(game->background);
+  game->background = NULL;
+  if ((pixels = SDL_CreateRGBSurfaceFrom(game->blob + entry->background, entry->width, entry->height, 32, entry->pitch, 0x00FF0000, 0x0000FF00, 0x000000FF, 0)) == NULL)
+    return;
+  SDL_SetColorKey(pixels, SDL_SRCCOLORKEY, 0);
+  // blitted every frame: converted to the screen's format once, the pixels in the blob as they are without a screen
+  if ((game->background = SDL_DisplayFormat(pixels)) == NULL)
+    game->background = pixels;
+  else {
+    SDL_SetColorKey(game->background, SDL_SRCCOLORKEY | SDL_RLEACCEL, SDL_MapRGB(game->background->format, 0, 0, 0));
+    SDL_FreeSurface(pixels);
+  }
+}
+int Blob_check(const char *base, size_t size, const char *path) {
+  BlobHeader *header = (BlobHeader *) base;
+  BlobEntry *entry = NULL;
+  Nav *navs = NULL;
+  Uint32 i = 0;
+  // no field of the header is read before the mapping is known to hold it
+  int valid = size >= sizeof(struct BlobHeader) && (Uint64) size <= 0xFFFFFFFF;
+  valid = valid && memcmp(header->magic, BLOB_MAGIC, 8) == 0 && header->version == BLOB_VERSION && header->size == (Uint32) size && header->maze_size == sizeof(struct Maze) && header->nav_size == sizeof(struct Nav) && header->mazes > 0
+    && Blob_fits(sizeof(struct BlobHeader), (Uint64) header->mazes * sizeof(struct BlobEntry), size)
+    && header->maze % sizeof(int) == 0 && Blob_fits(header->maze, (Uint64) header->mazes * sizeof(struct Maze), size)
+    && header->nav % sizeof(int) == 0 && Blob_fits(header->nav, (Uint64) header->mazes * sizeof(struct Nav), size);
+  if (valid) {
+    entry = (BlobEntry *) (base + sizeof(struct BlobHeader));
+    navs = (Nav *) (base + header->nav);
+  }
+  // every table of every maze inside the blob, before anything reads them
+  while (valid && i < header->mazes) {
+    Uint64 tiles = (navs[i].tiles > 0 && navs[i].tiles <= MAZE_HEIGHT * MAZE_WIDTH) ? navs[i].tiles : 0;
+    valid = tiles > 0 && navs[i].maze == (int) i && navs[i].tile % sizeof(int) == 0 && Blob_fits(navs[i].tile, tiles * sizeof(int), size) && Blob_fits(navs[i].distance, tiles * tiles, size) && Blob_fits(navs[i].hop, tiles * tiles, size)
+      && entry[i].background % 4 == 0 && (Uint64) entry[i].pitch >= (Uint64) entry[i].width * 4 && Blob_fits(entry[i].background, (Uint64) entry[i].pitch * entry[i].height, size);
+    ++i;
+  }
+  if (valid == 0) {
+    printf("Ignoring %s: built for another version of puckman\n", path);
+    return 0;
+  }
+  // nothing in it is written to, the Navs and their tables are read where they lie
+  game->blob = (char *) base;
+  game->mazes = (Maze *) (base + header->maze);
+  game->navs = navs;
+  game->tables = (Uint8 *) base;
+  game->maze_count = header->mazes;
+  return header->mazes;
+}
+int Blob_fits(Uint32 offset, Uint64 length, Uint32 size) {
+  return offset <= size && length <= size - offset;
+}
+int Blob_open(const char *path) {
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return 0;
+  if (fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(struct BlobHeader)) {
+    close(fd);
+    return 0;
+  }
+  char *base = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+    return 0;
+  int mazes = Blob_check(base, st.st_size, path);
+  if (mazes == 0) {
+    munmap(base, st.st_size);
+    return 0;
+  }
+  game->blob_size = st.st_size;
+  return mazes;
+}
+int Blob_pad(FILE *f, Uint32 offset) {
+  while ((Uint32) ftell(f) < offset)
+    if (fputc(0, f) == EOF)
+      return 0;
+  return 1;
+}
+int Blob_write(const char *path) {
+  BlobHeader header;
+  FILE *f = NULL;
+  int i = 0, err = 0, count = Maze_init("mazes/"), size = strlen(path) + 5;
+  if (count == 0) {
+    fprintf(stderr, "Could not load any maze from mazes/\n");
+    return 1;
   }
-  else if (ghost->dir == UP && Ghost_moveUp(ghost) == 0) {
-    if (x >= ghost->x && ghost->ways[RIGHT] == 1 && Ghost_moveRight(ghost) == 1)
-      ghost->dir = RIGHT;
-    else if (ghost->ways[LEFT] == 1 && Ghost_moveLeft(ghost) == 1)
-      ghost->dir = LEFT;
+  BlobEntry *entry = (BlobEntry *) calloc(count, sizeof(struct BlobEntry));
+  Nav *navs = (Nav *) calloc(count, sizeof(struct Nav));
+  SDL_Surface **backgrounds = (SDL_Surface **) calloc(count, sizeof(SDL_Surface *));
+  Uint8 **tables = (Uint8 **) calloc(count, sizeof(Uint8 *));
+  char *tmp = (char *) malloc(size * sizeof(char));
+  Uint32 tile, offset = sizeof(struct BlobHeader) + count * sizeof(struct BlobEntry);
+  memset(&header, 0, sizeof(struct BlobHeader));
+  memcpy(header.magic, BLOB_MAGIC, 8);
+  header.version = BLOB_VERSION;
+  header.mazes = count;
+  header.maze_size = sizeof(struct Maze);
+  header.nav_size = sizeof(struct Nav);
+  offset = (offset + BLOB_ALIGN - 1) / BLOB_ALIGN * BLOB_ALIGN;
+  header.maze = offset;
+  offset += count * sizeof(struct Maze);
+  header.nav = offset;
+  offset += count * sizeof(struct Nav);
+  // build everything the game would otherwise build at each start
+  while (err == 0 && i < count) {
+    game->maze = &game->mazes[i];
+    game->nav = &navs[i];
+    memcpy(game->walls, game->maze->walls, sizeof(game->walls));
+    Nav_build();
+    // kept for the writing below, the next Nav_build would free them
+    tables[i] = game->tables;
+    game->tables = NULL;
+    backgrounds[i] = SDL_CreateRGBSurface(SDL_SWSURFACE, SCREEN_WIDTH, MAZE_HEIGHT * 10, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+    if (backgrounds[i] == NULL) {
+      fprintf(stderr, "Could not create the background of maze %d: %s\n", i, SDL_GetError());
+      err = 1;
+    }
     else {
-      ghost->dir = RIGHT;
-      Ghost_moveRight(ghost);
+      game->screen = backgrounds[i];
+      drawMaze();
+      offset += navs[i].tiles * sizeof(int) + 2 * navs[i].tiles * navs[i].tiles;
+      offset = (offset + BLOB_ALIGN - 1) / BLOB_ALIGN * BLOB_ALIGN;
+      entry[i].background = offset;
+      entry[i].width = backgrounds[i]->w;
+      entry[i].height = backgrounds[i]->h;
+      entry[i].pitch = backgrounds[i]->pitch;
+      offset += entry[i].pitch * entry[i].height;
+    }
+    ++i;
+  }
+  game->screen = NULL;
+  header.size = offset;
+  // written aside and renamed over the old blob once whole, as the scores are
+  snprintf(tmp, size, "%s.tmp", path);
+  if (err == 0 && (f = fopen(tmp, "wb")) == NULL) {
+    fprintf(stderr, "Cannot open file %s\n", tmp);
+    err = 1;
+  }
+  if (err == 0)
+    err = fwrite(&header, sizeof(struct BlobHeader), 1, f) != 1 || fwrite(entry, sizeof(struct BlobEntry), count, f) != (size_t) count
+      || Blob_pad(f, header.maze) == 0 || fwrite(game->mazes, sizeof(struct Maze), count, f) != (size_t) count || Blob_pad(f, header.nav + count * sizeof(struct Nav)) == 0;
+  i = 0;
+  while (err == 0 && i < count) {
+    // the table offsets move from the block they were built in to where they lie in the blob
+    tile = ftell(f);
+    err = fwrite(tables[i] + navs[i].tile, sizeof(int), navs[i].tiles, f) != (size_t) navs[i].tiles || fwrite(tables[i] + navs[i].distance, 1, navs[i].tiles * navs[i].tiles, f) != (size_t) (navs[i].tiles * navs[i].tiles)
+      || fwrite(tables[i] + navs[i].hop, 1, navs[i].tiles * navs[i].tiles, f) != (size_t) (navs[i].tiles * navs[i].tiles) || Blob_pad(f, entry[i].background) == 0;
+    navs[i].tile = tile;
+    navs[i].distance = tile + navs[i].tiles * sizeof(int);
+    navs[i].hop = navs[i].distance + navs[i].tiles * navs[i].tiles;
+    if (err == 0) {
+      SDL_LockSurface(backgrounds[i]);
+      err = fwrite(backgrounds[i]->pixels, 1, entry[i].pitch * entry[i].height, f) != (size_t) (entry[i].pitch * entry[i].height);
+      SDL_UnlockSurface(backgrounds[i]);
+    }
+    ++i;
+  }
+  if (err == 0)
+    err = fseek(f, header.nav, SEEK_SET) != 0 || fwrite(navs, sizeof(struct Nav), count, f) != (size_t) count || fflush(f) != 0 || fsync(fileno(f)) != 0;
+  if (err != 0 && f != NULL)
+    fprintf(stderr, "Cannot write file %s\n", tmp);
+  if (f != NULL && fclose(f) != 0 && err == 0) {
+    fprintf(stderr, "Cannot write file %s\n", tmp);
+    err = 1;
+  }
+  if (err == 0 && rename(tmp, path) != 0) {
+    fprintf(stderr, "Cannot write file %s\n", path);
+    err = 1;
+  }
+  if (err == 0)
+    printf("%s: %d maze(s), %u bytes\n", path, count, header.size);
+  else if (f != NULL)
+    remove(tmp);
+  i = 0;
+  while (i < count) {
+    free(tables[i]);
+    if (backgrounds[i] != NULL)
+      SDL_FreeSurface(backgrounds[i]);
+    ++i;
+  }
+  free(tmp);
+  free(entry);
+  free(navs);
+  free(backgrounds);
+  free(tables);
+  free(game->mazes);
+  game->mazes = NULL;
+  return err;
+}
+void Board_begin() {
+  __atomic_store_n(&game->board->sequence, game->board->sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+void Board_close() {
+  if (game->board == NULL)
+    return;
+  Board_persist(1);
+  if (game->board_fd == -1)
+    free(game->board);
+  else {
+    munmap(game->board, sizeof(struct Board));
+    close(game->board_fd);
+  }
+  game->board = NULL;
+}
+Uint32 Board_copy(Score *scores) {
+  Board *board = game->board;
+  Uint32 sequence;
+  do {
+    sequence = __atomic_load_n(&board->sequence, __ATOMIC_ACQUIRE);
+    memcpy(scores, board->scores, sizeof(board->scores));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((sequence & 1) == 1 || __atomic_load_n(&board->sequence, __ATOMIC_RELAXED) != sequence);
+  return sequence;
+}
+void Board_end() {
+  __atomic_store_n(&game->board->sequence, game->board->sequence + 1, __ATOMIC_RELEASE);
+}
+void Board_open() {
+  struct stat st;
+  char name[32];
+  Board *board = (Board *) MAP_FAILED;
+  snprintf(name, sizeof(name), "/puckman-%d", (int) getuid());
+  if ((game->board_fd = shm_open(name, O_RDWR | O_CREAT, 0600)) != -1) {
+    // whoever comes first fills the segment from the file, the others wait for it on the lock
+    flock(game->board_fd, LOCK_EX);
+    if (fstat(game->board_fd, &st) == 0 && (st.st_size >= (off_t) sizeof(struct Board) || ftruncate(game->board_fd, sizeof(struct Board)) == 0))
+      board = (Board *) mmap(NULL, sizeof(struct Board), PROT_READ | PROT_WRITE, MAP_SHARED, game->board_fd, 0);
+    if (board == MAP_FAILED) {
+      flock(game->board_fd, LOCK_UN);
+      close(game->board_fd);
+    }
+  }
+  // the writer thread still needs a board to publish to
+  if (board == MAP_FAILED) {
+    printf("Cannot share memory as %s, high scores are not shared\n", name);
+    game->board_fd = -1;
+    board = (Board *) calloc(1, sizeof(struct Board));
+  }
+  if (memcmp(board->magic, SCORE_MAGIC, 8) != 0 || board->version != SCORE_VERSION) {
+    memcpy(board->scores, game->scores, sizeof(board->scores));
+    board->sequence = 0;
+    board->saved = 0;
+    board->version = SCORE_VERSION;
+    memcpy(board->magic, SCORE_MAGIC, 8);
+  }
+  // no writer holds the lock, an odd sequence is one killed in the middle of a change: its table is
+  // taken as it was left rather than have every reader wait for it forever
+  if ((board->sequence & 1) == 1)
+    __atomic_store_n(&board->sequence, board->sequence + 1, __ATOMIC_RELEASE);
+  if (game->board_fd != -1)
+    flock(game->board_fd, LOCK_UN);
+  game->board = board;
+  // odd, so that the first read copies
+  game->board_sequence = 1;
+  game->board_persisted = 0;
+  Board_read();
+}
+void Board_persist(int force) {
+  Board *board = game->board;
+  if (board == NULL || (force == 0 && SDL_GetTicks() - game->board_persisted < BOARD_PERSIST))
+    return;
+  game->board_persisted = SDL_GetTicks();
+  if (__atomic_load_n(&board->sequence, __ATOMIC_ACQUIRE) == __atomic_load_n(&board->saved, __ATOMIC_RELAXED))
+    return;
+  if (game->writer == NULL) {
+    Board_save();
+    return;
+  }
+  SDL_LockMutex(game->writer->lock);
+  game->writer->persist = 1;
+  SDL_CondSignal(game->writer->wake);
+  SDL_UnlockMutex(game->writer->lock);
+}
+void Board_read() {
+  Board *board = game->board;
+  if (board == NULL || __atomic_load_n(&board->sequence, __ATOMIC_ACQUIRE) == game->board_sequence)
+    return;
+  game->board_sequence = Board_copy(game->scores);
+}
+void Board_save() {
+  Board *board = game->board;
+  Score scores[SCORES];
+  // one instance writes each change, under the lock so that no insert slips in between
+  if (game->board_fd != -1)
+    flock(game->board_fd, LOCK_EX);
+  if (board->sequence != board->saved) {
+    Board_copy(scores);
+    Score_write(scores);
+    __atomic_store_n(&board->saved, board->sequence, __ATOMIC_RELAXED);
+  }
+  if (game->board_fd != -1)
+    flock(game->board_fd, LOCK_UN);
+}
+void Bundle_evict(int b) {
+  Bundle *bundle = &bundles[b];
+  int i = 0;
+  while (i < bundle->count)
+    Asset_put(bundle->image[i++]);
+  bundle->count = 0;
+  bundle->size = 0;
+  bundle->loaded = 0;
+}
+void Bundle_load(int b) {
+  Loader_start(game->workers, b);
+  game->bundle = &bundles[b];
+  Image_load(b);
+  game->bundle = NULL;
+  Loader_stop();
+  bundles[b].loaded = 1;
+}
+int Bundle_screen() {
+  if (game->state == 5)
+    return (1 << BUNDLE_TITLE) | (1 << BUNDLE_MENU);
+  if (game->state == 6)
+    return 1 << BUNDLE_MENU;
+  if (game->state == 7 || game->state == 8)
+    return (1 << BUNDLE_MENU) | (1 << BUNDLE_SCORES);
+  return 1 << BUNDLE_GAME;
+}
+void Bundle_use(int mask) {
+  Uint32 size = 0;
+  int b = 0, old;
+  while (b < BUNDLES) {
+    if ((mask & (1 << b)) != 0) {
+      if (bundles[b].loaded == 0)
+        Bundle_load(b);
+      bundles[b].used = SDL_GetTicks();
+    }
+    if (bundles[b].loaded == 1)
+      size += bundles[b].size;
+    ++b;
+  }
+  // over budget, evict the bundles shown longest ago, never those on screen
+  while (size > BUNDLE_BUDGET) {
+    old = -1;
+    b = 0;
+    while (b < BUNDLES) {
+      if (bundles[b].loaded == 1 && (mask & (1 << b)) == 0 && (old == -1 || bundles[b].used < bundles[old].used))
+        old = b;
+      ++b;
     }
+    if (old == -1)
+      break;
+    size -= bundles[old].size;
+    Bundle_evict(old);
+  }
+}
+int Check_bot(int maze) {
+  // the bot plays the maze from its first level: it has to eat half of it, or all of it, without
+  // pushing against a wall CHECK_STALL frames in a row
+  Controller *controller = Controller_open("bot", NULL);
+  int dir, stall = 0, most = 0, food = -1, least = 0;
+  Game_new();
+  game->level = maze;
+  while (game->frame < CHECK_FRAMES && game->state != 8 && game->level <= maze + 1) {
+    if ((dir = controller->next(controller, game)) != CONTROLLER_KEEP)
+      game->pacman->nextDir = dir;
+    Game_advance();
+    Game_step();
+    if (game->state == 1 && food == -1)
+      food = least = game->food_count;
+    least = (game->state == 1 && game->food_count < least) ? game->food_count : least;
+    stall = (game->state == 1 && game->pacman->stuck) ? stall + 1 : 0;
+    most = (stall > most) ? stall : most;
+  }
+  Controller_close(controller);
+  if (game->level > maze + 1)
+    least = 0;
+  printf("maze %d: the bot ate %d of %d pellets in %u frames, against a wall %d frames in a row at most\n", maze, food - least, food, game->frame, most);
+  return food > 0 && (food - least) * 2 >= food && most < CHECK_STALL;
+}
+int Check_paths(int maze) {
+  // the nav wraps where Pac-Man and the ghosts do: only across the tunnel rows, one tile from either end
+  Maze *m = &game->mazes[maze];
+  int Y = 0, X, y, x, dir, kind, wrong = 0, tunnels = 0;
+  Game_new();
+  game->level = maze + 1;
+  raiseWalls();
+  while (Y < MAZE_HEIGHT) {
+    X = 0;
+    while (X < MAZE_WIDTH) {
+      kind = 0;
+      while (kind < 3) {
+        dir = 0;
+        while (dir < 4) {
+          y = Y;
+          x = X;
+          Nav_step(m, &y, &x, dir);
+          if ((game->nav->exits[kind][Y][X] & (1 << dir)) && abs(y - Y) + abs(x - X) != 1 && (m->tunnel[Y] == 0 || (dir != RIGHT && dir != LEFT)))
+            ++wrong;
+          ++dir;
+        }
+        ++kind;
+      }
+      ++X;
+    }
+    if (m->tunnel[Y] && m->wrap[0] >= 0) {
+      ++tunnels;
+      if (Nav_distance(game, Y, m->wrap[1] / 10, Y, m->wrap[0] / 10) != 1 || Nav_distance(game, Y, m->wrap[0] / 10, Y, m->wrap[2] / 10) != 1)
+        ++wrong;
+    }
+    ++Y;
+  }
+  printf("maze %d: %d tunnel row(s), %d wrong wrap(s) in the paths\n", maze, tunnels, wrong);
+  return wrong == 0;
+}
+int Check_run(const char *dir) {
+  int i = 0, failed = 0;
+  if (Maze_init(dir) == 0) {
+    fprintf(stderr, "Could not load any maze from %s\n", dir);
+    return 1;
+  }
+  game->headless = 1;
+  while (i < game->maze_count) {
+    if (Check_paths(i) == 0 || Check_bot(i) == 0)
+      ++failed;
+    ++i;
   }
+  printf("%s: %d of %d maze(s) failed\n", dir, failed, game->maze_count);
+  return failed != 0;
 }
 int cleanUp(int err) {
+  IMG_Quit();
   SDL_Quit();
   return err;
 }
-void Clyde_chase(Ghost *ghost) {
-  int x = game->pacman->x;
-  int y = game->pacman->y;
-  if (ghost->state == 1 || ghost->state == 2) {
-    x = 461 - x;
-    y = 580 - y;
-  }
-  if (ghost->dir == LEFT && Ghost_moveLeft(ghost) == 0) {
-    if (y >= ghost->y && ghost->ways[DOWN] == 1 && Ghost_moveDown(ghost) == 1)
-      ghost->dir = DOWN;
-    else if (ghost->ways[UP] == 1 && Ghost_moveUp(ghost) == 1)
-      ghost->dir = UP;
+int Clyde::target(int g, int *x, int *y) {
+  // no target of his own, Pac-Man's side only decides where to turn at walls
+  *x = game->pacman->x;
+  *y = game->pacman->y;
+  return 0;
+}
+int Collision_check() {
+  Collision *c = game->collision;
+  Ghosts *ghosts = game->ghosts;
+  int g = 0, jump, touch[4], hits = c->hits, px = game->pacman->x, py = game->pacman->y;
+  // a tunnel wrap is a jump, not a path to sweep
+  if (abs(px - c->from[0][0]) > COLLISION_REACH || abs(py - c->from[0][1]) > COLLISION_REACH) {
+    c->from[0][0] = px;
+    c->from[0][1] = py;
+  }
+  while (g < 4) {
+    jump = abs(ghosts->x[g] - c->from[g + 1][0]) > COLLISION_REACH || abs(ghosts->y[g] - c->from[g + 1][1]) > COLLISION_REACH;
+    c->from[g + 1][0] = jump ? ghosts->x[g] : c->from[g + 1][0];
+    c->from[g + 1][1] = jump ? ghosts->y[g] : c->from[g + 1][1];
+    touch[g] = ghosts->state[g] < 3 && Collision_swept(c->from[g + 1][0] - c->from[0][0], c->from[g + 1][1] - c->from[0][1], ghosts->x[g] - px, ghosts->y[g] - py);
+    c->from[g + 1][0] = ghosts->x[g];
+    c->from[g + 1][1] = ghosts->y[g];
+    ++g;
+  }
+  g = 0;
+  while (g < 4) {
+    if (touch[g] && c->hits < 4)
+      c->hit[c->hits++] = g;
+    ++g;
+  }
+  c->from[0][0] = px;
+  c->from[0][1] = py;
+  return c->hits - hits;
+}
+void Collision_reset() {
+  Collision *c = game->collision;
+  int g = 0;
+  c->hits = 0;
+  c->from[0][0] = game->pacman->x;
+  c->from[0][1] = game->pacman->y;
+  while (g < 4) {
+    c->from[g + 1][0] = game->ghosts->x[g];
+    c->from[g + 1][1] = game->ghosts->y[g];
+    ++g;
+  }
+}
+int Collision_swept(int x0, int y0, int x1, int y1) {
+  // slab test of the ghost's path relative to Pac-Man against the box of reach COLLISION_REACH
+  int from[2] = { x0, y0 }, step[2] = { x1 - x0, y1 - y0 }, axis = 0;
+  double enter = 0, leave = 1, t0, t1;
+  while (axis < 2) {
+    if (step[axis] == 0) {
+      if (abs(from[axis]) > COLLISION_REACH)
+        return 0;
+    }
     else {
-      ghost->dir = DOWN;
-      Ghost_moveDown(ghost);
+      t0 = (double) (-COLLISION_REACH - from[axis]) / step[axis];
+      t1 = (double) (COLLISION_REACH - from[axis]) / step[axis];
+      if (t0 > t1) {
+        double t = t0;
+        t0 = t1;
+        t1 = t;
+      }
+      enter = (t0 > enter) ? t0 : enter;
+      leave = (t1 < leave) ? t1 : leave;
+      if (enter > leave)
+        return 0;
     }
+    ++axis;
   }
-  else if (ghost->dir == DOWN && Ghost_moveDown(ghost) == 0) {
-    if (x >= ghost->x && ghost->ways[RIGHT] == 1 && Ghost_moveRight(ghost) == 1)
-      ghost->dir = RIGHT;
-    else if (ghost->ways[LEFT] == 1 && Ghost_moveLeft(ghost) == 1)
-      ghost->dir = LEFT;
-    else {
-      ghost->dir = RIGHT;
-      Ghost_moveRight(ghost);
+  return 1;
+}
+int Controller_bot(Controller *controller, const GameData *view) {
+  // walks a few tiles down each way and heads where it gets the most ahead of the ghosts that can
+  // kill it, up to BOT_FAR tiles, then where there is most to eat; ties go to a direction it takes
+  // a whim for now and then, then to going on
+  int tile = Nav_cell(view, Nav_nearest(view, view->pacman->x, view->pacman->y)), ghost[4], d = 0, g = 0, Y, X, moved, food, ahead, value;
+  int best = CONTROLLER_KEEP, best_value = -1, whim = view->pacman->nextDir;
+  controller->seed = controller->seed * 1103515245 + 12345;
+  if ((controller->seed >> 16) % 16 == 0)
+    whim = (controller->seed >> 20) % 4;
+  while (g < 4) {
+    ghost[g] = (view->ghosts->state[g] == 0) ? Nav_cell(view, Nav_nearest(view, view->ghosts->x[g], view->ghosts->y[g])) : -1;
+    ++g;
+  }
+  while (d < 4) {
+    Y = tile / MAZE_WIDTH;
+    X = tile % MAZE_WIDTH;
+    moved = 0;
+    food = 0;
+    ahead = BOT_FAR;
+    while (moved < BOT_LOOKAHEAD && (view->nav->exits[NAV_PACMAN][Y][X] & (1 << d))) {
+      Nav_step(view->maze, &Y, &X, d);
+      ++moved;
+      food += view->walls[Y][X] == 1;
+      g = 0;
+      while (g < 4) {
+        if (ghost[g] != -1 && (value = Nav_distance(view, ghost[g] / MAZE_WIDTH, ghost[g] % MAZE_WIDTH, Y, X) - moved) < ahead)
+          ahead = value;
+        ++g;
+      }
+    }
+    value = (ahead + BOT_LOOKAHEAD) * 64 + food * 4 + ((d == whim) ? 2 : 0) + ((d == view->pacman->dir) ? 1 : 0);
+    if (moved > 0 && value > best_value) {
+      best_value = value;
+      best = d;
     }
+    ++d;
   }
-  else if (ghost->dir == RIGHT && Ghost_moveRight(ghost) == 0) {
-    if (y >= ghost->y && ghost->ways[DOWN] == 1 && Ghost_moveDown(ghost) == 1)
-      ghost->dir = DOWN;
-    else if (ghost->ways[UP] == 1 && Ghost_moveUp(ghost) == 1)
-      ghost->dir = UP;
-    else {
-      ghost->dir = DOWN;
-      Ghost_moveDown(ghost);
+  return best;
+}
+void Controller_close(Controller *controller) {
+  if (controller == NULL)
+    return;
+  free(controller->frame);
+  free(controller->dir);
+  if (controller->in != -1)
+    close(controller->in);
+  if (controller->out != -1)
+    close(controller->out);
+  // a process should leave on its closed input; one that does not within CONTROLLER_GRACE tries 10 ms
+  // apart is sent SIGTERM, and SIGKILL as many tries later
+  int tries = 0;
+  while (controller->pid > 0 && waitpid(controller->pid, NULL, WNOHANG) == 0) {
+    if (tries == CONTROLLER_GRACE)
+      kill(controller->pid, SIGTERM);
+    else if (tries == 2 * CONTROLLER_GRACE)
+      kill(controller->pid, SIGKILL);
+    SDL_Delay(10);
+    ++tries;
+  }
+  free(controller);
+}
+int Controller_keyboard(Controller *controller, const GameData *view) {
+  Uint8 *keystate = SDL_GetKeyState(NULL);
+  if (keystate[SDLK_RIGHT])
+    return RIGHT;
+  if (keystate[SDLK_LEFT])
+    return LEFT;
+  if (keystate[SDLK_UP])
+    return UP;
+  if (keystate[SDLK_DOWN])
+    return DOWN;
+  return CONTROLLER_KEEP;
+}
+Controller *Controller_open(const char *kind, const char *arg) {
+  // keys; bot; script file, made of lines "frame R|L|U|D" in frame order; exec command, run by the
+  // shell, which reads an Observation from its standard input every frame and answers a byte:
+  // the direction, or anything else to keep it, as does an answer not in within the frame's delay
+  Controller *controller = (Controller *) malloc(sizeof(struct Controller));
+  Uint32 frame, size = 0;
+  char c;
+  int to[2] = { -1, -1 }, from[2] = { -1, -1 }, i = 0;
+  FILE *f;
+  controller->frame = NULL;
+  controller->dir = NULL;
+  controller->count = 0;
+  controller->index = 0;
+  controller->seed = 1;
+  controller->in = -1;
+  controller->out = -1;
+  controller->late = 0;
+  controller->pid = 0;
+  if (strcmp(kind, "keys") == 0)
+    controller->next = Controller_keyboard;
+  else if (strcmp(kind, "bot") == 0)
+    controller->next = Controller_bot;
+  else if (strcmp(kind, "script") == 0 && arg != NULL) {
+    controller->next = Controller_script;
+    if ((f = fopen(arg, "r")) == NULL) {
+      printf("Cannot open file %s\n", arg);
+      free(controller);
+      return NULL;
     }
+    while (fscanf(f, "%u %c", &frame, &c) == 2 && strchr("RLUD", c) != NULL) {
+      if (controller->count == size) {
+        size = (size == 0) ? 64 : size * 2;
+        controller->frame = (Uint32 *) realloc(controller->frame, size * sizeof(Uint32));
+        controller->dir = (Uint8 *) realloc(controller->dir, size);
+      }
+      controller->frame[controller->count] = frame;
+      controller->dir[controller->count++] = strchr("RLUD", c) - "RLUD";
+    }
+    fclose(f);
   }
-  else if (ghost->dir == UP && Ghost_moveUp(ghost) == 0) {
-    if (x >= ghost->x && ghost->ways[RIGHT] == 1 && Ghost_moveRight(ghost) == 1)
-      ghost->dir = RIGHT;
-    else if (ghost->ways[LEFT] == 1 && Ghost_moveLeft(ghost) == 1)
-      ghost->dir = LEFT;
-    else {
-      ghost->dir = RIGHT;
-      Ghost_moveRight(ghost);
+  else if (strcmp(kind, "exec") == 0 && arg != NULL) {
+    controller->next = Controller_process;
+    if (pipe(to) != 0 || pipe(from) != 0 || (controller->pid = fork()) == -1) {
+      fprintf(stderr, "Could not start %s\n", arg);
+      // whichever of the pipes was made before the failure
+      while (i < 2) {
+        if (to[i] != -1)
+          close(to[i]);
+        if (from[i] != -1)
+          close(from[i]);
+        ++i;
+      }
+      free(controller);
+      return NULL;
     }
+    if (controller->pid == 0) {
+      dup2(to[0], 0);
+      dup2(from[1], 1);
+      close(to[0]);
+      close(to[1]);
+      close(from[0]);
+      close(from[1]);
+      execl("/bin/sh", "sh", "-c", arg, (char *) NULL);
+      _exit(127);
+    }
+    close(to[0]);
+    close(from[1]);
+    controller->in = to[1];
+    controller->out = from[0];
+    // a controller gone away is read as keeping the direction rather than killing the game
+    signal(SIGPIPE, SIG_IGN);
+  }
+  else {
+    printf("Unknown controller %s\n", kind);
+    free(controller);
+    return NULL;
+  }
+  return controller;
+}
+int Controller_process(Controller *controller, const GameData *view) {
+  Observation observation;
+  struct pollfd answer;
+  Uint8 dir = 4;
+  int ready = 1, err = 0;
+  if (controller->in == -1)
+    return CONTROLLER_KEEP;
+  answer.fd = controller->out;
+  answer.events = POLLIN;
+  // answers that missed their frame are dropped as they come, and no observation is sent before them
+  while (err == 0 && controller->late > 0 && poll(&answer, 1, 0) == 1) {
+    err = read(controller->out, &dir, 1) != 1;
+    --(controller->late);
+  }
+  if (err == 0 && controller->late > 0)
+    return CONTROLLER_KEEP;
+  dir = 4;
+  if (err == 0) {
+    Observation_take(&observation, view);
+    err = write(controller->in, &observation, sizeof(observation)) != sizeof(observation);
+  }
+  // a process slower than a frame keeps the direction rather than holding the game up
+  if (err == 0 && ((ready = poll(&answer, 1, view->delay)) == 0 || (ready == -1 && errno == EINTR)))
+    ++(controller->late);
+  else if (err == 0)
+    err = ready != 1 || read(controller->out, &dir, 1) != 1;
+  if (err != 0) {
+    close(controller->in);
+    controller->in = -1;
+    return CONTROLLER_KEEP;
+  }
+  return (dir < 4) ? dir : CONTROLLER_KEEP;
+}
+int Controller_run(const char *kind, const char *arg, Uint32 frames) {
+  Controller *controller = Controller_open(kind, arg);
+  int dir;
+  if (controller == NULL)
+    return 1;
+  game->headless = 1;
+  Game_new();
+  while (game->frame < frames && game->state != 8) {
+    if ((dir = controller->next(controller, game)) != CONTROLLER_KEEP)
+      game->pacman->nextDir = dir;
+    Game_advance();
+    Game_step();
   }
+  printf("score %d level %d state %d frames %u\n", game->score, game->level, game->state, game->frame);
+  Controller_close(controller);
+  return 0;
+}
+int Controller_script(Controller *controller, const GameData *view) {
+  while (controller->index < controller->count && controller->frame[controller->index] <= view->frame)
+    ++(controller->index);
+  return (controller->index == 0) ? CONTROLLER_KEEP : controller->dir[controller->index - 1];
 }
 void drawBonus(int x, int y) {
   SDL_Surface *img;
@@ -494,490 +1934,22 @@ void drawBottom() {
   drawNumber(game->score, 180, 542);
 }
 void drawCandies() {
-  int i = 25;
-  if (game->walls[2][2] == 1)
-    drawCandy(25, i);
-  if (game->walls[2][4] == 1)
-    drawCandy(40, i);
-  if (game->walls[2][5] == 1)
-    drawCandy(55, i);
-  if (game->walls[2][7] == 1)
-    drawCandy(70, i);
-  if (game->walls[2][8] == 1)
-    drawCandy(89, i);
-  if (game->walls[2][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[2][12] == 1)
-    drawCandy(120, i);
-  if (game->walls[2][13] == 1)
-    drawCandy(139, i);
-  if (game->walls[2][15] == 1)
-    drawCandy(155, i);
-  if (game->walls[2][17] == 1)
-    drawCandy(170, i);
-  if (game->walls[2][18] == 1)
-    drawCandy(189, i);
-  if (game->walls[2][20] == 1)
-    drawCandy(205, i);
-  if (game->walls[2][25] == 1)
-    drawCandy(255, i);
-  if (game->walls[2][27] == 1)
-    drawCandy(270, i);
-  if (game->walls[2][28] == 1)
-    drawCandy(289, i);
-  if (game->walls[2][30] == 1)
-    drawCandy(305, i);
-  if (game->walls[2][31] == 1)
-    drawCandy(319, i);
-  if (game->walls[2][33] == 1)
-    drawCandy(339, i);
-  if (game->walls[2][35] == 1)
-    drawCandy(355, i);
-  if (game->walls[2][37] == 1)
-    drawCandy(371, i);
-  if (game->walls[2][38] == 1)
-    drawCandy(389, i);
-  if (game->walls[2][40] == 1)
-    drawCandy(405, i);
-  if (game->walls[2][41] == 1)
-    drawCandy(419, i);
-  if (game->walls[2][43] == 1)
-    drawCandy(434, i);
-  int j = 4;
-  i += 15;
-  while (i < 82) {
-    if (j == 4) {
-      if (game->walls[j][2] == 1)
-        drawPower(20, 47);
-      if (game->walls[j][43] == 1)
-        drawPower(428, 47);
-    }
-    if (game->walls[j][2] == 1)
-      drawCandy(25, i);
-    if (game->walls[j][10] == 1)
-      drawCandy(105, i);
-    if (game->walls[j][20] == 1)
-      drawCandy(205, i);
-    if (game->walls[j][25] == 1)
-      drawCandy(255, i);
-    if (game->walls[j][35] == 1)
-      drawCandy(355, i);
-    if (game->walls[j][43] == 1)
-      drawCandy(434, i);
-    ++j;
-    i += 14;
-  }
-  i += 3;
-  if (game->walls[8][2] == 1)
-    drawCandy(25, i);
-  if (game->walls[8][4] == 1)
-    drawCandy(40, i);
-  if (game->walls[8][5] == 1)
-    drawCandy(55, i);
-  if (game->walls[8][7] == 1)
-    drawCandy(70, i);
-  if (game->walls[8][8] == 1)
-    drawCandy(89, i);
-  if (game->walls[8][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[8][12] == 1)
-    drawCandy(120, i);
-  if (game->walls[8][13] == 1)
-    drawCandy(139, i);
-  if (game->walls[8][15] == 1)
-    drawCandy(155, i);
-  if (game->walls[8][17] == 1)
-    drawCandy(170, i);
-  if (game->walls[8][18] == 1)
-    drawCandy(189, i);
-  if (game->walls[8][20] == 1)
-    drawCandy(205, i);
-  if (game->walls[8][25] == 1)
-    drawCandy(255, i);
-  if (game->walls[8][27] == 1)
-    drawCandy(270, i);
-  if (game->walls[8][28] == 1)
-    drawCandy(289, i);
-  if (game->walls[8][30] == 1)
-    drawCandy(305, i);
-  if (game->walls[8][31] == 1)
-    drawCandy(319, i);
-  if (game->walls[8][33] == 1)
-    drawCandy(339, i);
-  if (game->walls[8][35] == 1)
-    drawCandy(355, i);
-  if (game->walls[8][37] == 1)
-    drawCandy(371, i);
-  if (game->walls[8][38] == 1)
-    drawCandy(389, i);
-  if (game->walls[8][40] == 1)
-    drawCandy(405, i);
-  if (game->walls[8][41] == 1)
-    drawCandy(419, i);
-  if (game->walls[8][43] == 1)
-    drawCandy(434, i);
-  if (game->walls[8][22] == 1)
-    drawCandy(220, i);
-  if (game->walls[8][23] == 1)
-    drawCandy(239, i);
-  j = 10;
-  i += 15;
-  while (i < 120) {
-    if (game->walls[j][2] == 1)
-      drawCandy(25, i);
-    if (game->walls[j][10] == 1)
-      drawCandy(105, i);
-    if (game->walls[j][15] == 1)
-      drawCandy(155, i);
-    if (game->walls[j][30] == 1)
-      drawCandy(305, i);
-    if (game->walls[j][35] == 1)
-      drawCandy(355, i);
-    if (game->walls[j][43] == 1)
-      drawCandy(434, i);
-    ++j;
-    i += 19;
-  }
-  i -= 3;
-  if (game->walls[13][2] == 1)
-    drawCandy(25, i);
-  if (game->walls[13][4] == 1)
-    drawCandy(40, i);
-  if (game->walls[13][5] == 1)
-    drawCandy(55, i);
-  if (game->walls[13][7] == 1)
-    drawCandy(70, i);
-  if (game->walls[13][8] == 1)
-    drawCandy(89, i);
-  if (game->walls[13][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[13][15] == 1)
-    drawCandy(155, i);
-  if (game->walls[13][17] == 1)
-    drawCandy(170, i);
-  if (game->walls[13][18] == 1)
-    drawCandy(189, i);
-  if (game->walls[13][20] == 1)
-    drawCandy(205, i);
-  if (game->walls[13][25] == 1)
-    drawCandy(255, i);
-  if (game->walls[13][27] == 1)
-    drawCandy(270, i);
-  if (game->walls[13][28] == 1)
-    drawCandy(289, i);
-  if (game->walls[13][30] == 1)
-    drawCandy(305, i);
-  if (game->walls[13][35] == 1)
-    drawCandy(355, i);
-  if (game->walls[13][37] == 1)
-    drawCandy(371, i);
-  if (game->walls[13][38] == 1)
-    drawCandy(389, i);
-  if (game->walls[13][40] == 1)
-    drawCandy(405, i);
-  if (game->walls[13][41] == 1)
-    drawCandy(419, i);
-  if (game->walls[13][43] == 1)
-    drawCandy(434, i);
-  i += 15;
-  if (game->walls[15][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[15][35] == 1)
-    drawCandy(355, i);
-  i += 19;
-  if (game->walls[16][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[16][35] == 1)
-    drawCandy(355, i);
-  i += 15;
-  if (game->walls[18][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[18][35] == 1)
-    drawCandy(355, i);
-  i += 16;
-  if (game->walls[20][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[20][35] == 1)
-    drawCandy(355, i);
-  i += 15;
-  if (game->walls[21][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[21][35] == 1)
-    drawCandy(355, i);
-  i += 14;
-  if (game->walls[22][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[22][35] == 1)
-    drawCandy(355, i);
-  i += 16;
-  if (game->walls[24][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[24][35] == 1)
-    drawCandy(355, i);
-  i += 15;
-  if (game->walls[26][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[26][35] == 1)
-    drawCandy(355, i);
-  i += 15;
-  if (game->walls[27][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[27][35] == 1)
-    drawCandy(355, i);
-  i += 14;
-  if (game->walls[28][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[28][35] == 1)
-    drawCandy(355, i);
-  i += 16;
-  if (game->walls[30][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[30][35] == 1)
-    drawCandy(355, i);
-  i += 15;
-  if (game->walls[32][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[32][35] == 1)
-    drawCandy(355, i);
-  i += 19;
-  if (game->walls[33][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[33][35] == 1)
-    drawCandy(355, i);
-  i += 15;
-  if (game->walls[35][2] == 1)
-    drawCandy(25, i);
-  if (game->walls[35][4] == 1)
-    drawCandy(40, i);
-  if (game->walls[35][5] == 1)
-    drawCandy(55, i);
-  if (game->walls[35][7] == 1)
-    drawCandy(70, i);
-  if (game->walls[35][8] == 1)
-    drawCandy(89, i);
-  if (game->walls[35][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[35][12] == 1)
-    drawCandy(120, i);
-  if (game->walls[35][13] == 1)
-    drawCandy(139, i);
-  if (game->walls[35][15] == 1)
-    drawCandy(155, i);
-  if (game->walls[35][17] == 1)
-    drawCandy(170, i);
-  if (game->walls[35][18] == 1)
-    drawCandy(189, i);
-  if (game->walls[35][20] == 1)
-    drawCandy(205, i);
-  if (game->walls[35][25] == 1)
-    drawCandy(255, i);
-  if (game->walls[35][27] == 1)
-    drawCandy(270, i);
-  if (game->walls[35][28] == 1)
-    drawCandy(289, i);
-  if (game->walls[35][30] == 1)
-    drawCandy(305, i);
-  if (game->walls[35][31] == 1)
-    drawCandy(319, i);
-  if (game->walls[35][33] == 1)
-    drawCandy(339, i);
-  if (game->walls[35][35] == 1)
-    drawCandy(355, i);
-  if (game->walls[35][37] == 1)
-    drawCandy(371, i);
-  if (game->walls[35][38] == 1)
-    drawCandy(389, i);
-  if (game->walls[35][40] == 1)
-    drawCandy(405, i);
-  if (game->walls[35][41] == 1)
-    drawCandy(419, i);
-  if (game->walls[35][43] == 1)
-    drawCandy(434, i);
-  j = 37;
-  i += 16;
-  while (i < 390) {
-    if (game->walls[j][2] == 1)
-      drawCandy(25, i);
-    if (game->walls[j][10] == 1)
-      drawCandy(105, i);
-    if (game->walls[j][20] == 1)
-      drawCandy(205, i);
-    if (game->walls[j][25] == 1)
-      drawCandy(255, i);
-    if (game->walls[j][35] == 1)
-      drawCandy(355, i);
-    if (game->walls[j][43] == 1)
-      drawCandy(434, i);
-    ++j;
-    i += 19;
-  }
-  i -= 3;
-  if (game->walls[40][2] == 1)
-    drawPower(20, 400);
-  if (game->walls[40][4] == 1)
-    drawCandy(40, i);
-  if (game->walls[40][5] == 1)
-    drawCandy(55, i);
-  if (game->walls[40][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[40][12] == 1)
-    drawCandy(120, i);
-  if (game->walls[40][13] == 1)
-    drawCandy(139, i);
-  if (game->walls[40][15] == 1)
-    drawCandy(155, i);
-  if (game->walls[40][17] == 1)
-    drawCandy(170, i);
-  if (game->walls[40][18] == 1)
-    drawCandy(189, i);
-  if (game->walls[40][20] == 1)
-    drawCandy(205, i);
-  if (game->walls[40][25] == 1)
-    drawCandy(255, i);
-  if (game->walls[40][27] == 1)
-    drawCandy(270, i);
-  if (game->walls[40][28] == 1)
-    drawCandy(289, i);
-  if (game->walls[40][30] == 1)
-    drawCandy(305, i);
-  if (game->walls[40][31] == 1)
-    drawCandy(319, i);
-  if (game->walls[40][33] == 1)
-    drawCandy(339, i);
-  if (game->walls[40][35] == 1)
-    drawCandy(355, i);
-  if (game->walls[40][40] == 1)
-    drawCandy(405, i);
-  if (game->walls[40][41] == 1)
-    drawCandy(419, i);
-  if (game->walls[40][43] == 1)
-    drawPower(428, 400);
-  j = 42;
-  i += 16;
-  while (i < 440) {
-    if (game->walls[j][5] == 1)
-      drawCandy(55, i);
-    if (game->walls[j][10] == 1)
-      drawCandy(105, i);
-    if (game->walls[j][15] == 1)
-      drawCandy(155, i);
-    if (game->walls[j][30] == 1)
-      drawCandy(305, i);
-    if (game->walls[j][35] == 1)
-      drawCandy(355, i);
-    if (game->walls[j][40] == 1)
-      drawCandy(405, i);
-    ++j;
-    i += 18;
-  }
-  i -= 3;
-  if (game->walls[45][2] == 1)
-    drawCandy(25, i);
-  if (game->walls[45][4] == 1)
-    drawCandy(40, i);
-  if (game->walls[45][5] == 1)
-    drawCandy(55, i);
-  if (game->walls[45][7] == 1)
-    drawCandy(70, i);
-  if (game->walls[45][8] == 1)
-    drawCandy(89, i);
-  if (game->walls[45][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[45][15] == 1)
-    drawCandy(155, i);
-  if (game->walls[45][17] == 1)
-    drawCandy(170, i);
-  if (game->walls[45][18] == 1)
-    drawCandy(189, i);
-  if (game->walls[45][20] == 1)
-    drawCandy(205, i);
-  if (game->walls[45][25] == 1)
-    drawCandy(255, i);
-  if (game->walls[45][27] == 1)
-    drawCandy(270, i);
-  if (game->walls[45][28] == 1)
-    drawCandy(289, i);
-  if (game->walls[45][30] == 1)
-    drawCandy(305, i);
-  if (game->walls[45][35] == 1)
-    drawCandy(355, i);
-  if (game->walls[45][37] == 1)
-    drawCandy(371, i);
-  if (game->walls[45][38] == 1)
-    drawCandy(389, i);
-  if (game->walls[45][40] == 1)
-    drawCandy(405, i);
-  if (game->walls[45][41] == 1)
-    drawCandy(419, i);
-  if (game->walls[45][43] == 1)
-    drawCandy(434, i);
-  j = 47;
-  i += 16;
-  while (i < 490) {
-    if (game->walls[j][2] == 1)
-      drawCandy(25, i);
-    if (game->walls[j][20] == 1)
-      drawCandy(205, i);
-    if (game->walls[j][25] == 1)
-      drawCandy(255, i);
-    if (game->walls[j][43] == 1)
-      drawCandy(434, i);
-    ++j;
-    i += 19;
-  }
-  i -= 3;
-  if (game->walls[50][2] == 1)
-    drawCandy(25, i);
-  if (game->walls[50][4] == 1)
-    drawCandy(40, i);
-  if (game->walls[50][5] == 1)
-    drawCandy(55, i);
-  if (game->walls[50][7] == 1)
-    drawCandy(70, i);
-  if (game->walls[50][8] == 1)
-    drawCandy(89, i);
-  if (game->walls[50][10] == 1)
-    drawCandy(105, i);
-  if (game->walls[50][12] == 1)
-    drawCandy(120, i);
-  if (game->walls[50][13] == 1)
-    drawCandy(139, i);
-  if (game->walls[50][15] == 1)
-    drawCandy(155, i);
-  if (game->walls[50][17] == 1)
-    drawCandy(170, i);
-  if (game->walls[50][18] == 1)
-    drawCandy(189, i);
-  if (game->walls[50][20] == 1)
-    drawCandy(205, i);
-  if (game->walls[50][25] == 1)
-    drawCandy(255, i);
-  if (game->walls[50][27] == 1)
-    drawCandy(270, i);
-  if (game->walls[50][28] == 1)
-    drawCandy(289, i);
-  if (game->walls[50][30] == 1)
-    drawCandy(305, i);
-  if (game->walls[50][31] == 1)
-    drawCandy(319, i);
-  if (game->walls[50][33] == 1)
-    drawCandy(339, i);
-  if (game->walls[50][35] == 1)
-    drawCandy(355, i);
-  if (game->walls[50][37] == 1)
-    drawCandy(371, i);
-  if (game->walls[50][38] == 1)
-    drawCandy(389, i);
-  if (game->walls[50][40] == 1)
-    drawCandy(405, i);
-  if (game->walls[50][41] == 1)
-    drawCandy(419, i);
-  if (game->walls[50][43] == 1)
-    drawCandy(434, i);
-  if (game->walls[50][22] == 1)
-    drawCandy(220, i);
-  if (game->walls[50][23] == 1)
-    drawCandy(239, i);
+  Maze *maze = game->maze;
+  int Y = 0, X, i = 0;
+  while (Y < MAZE_HEIGHT) {
+    X = 0;
+    while (X < MAZE_WIDTH) {
+      if (game->walls[Y][X] == 1 && maze->power[Y][X] == 0 && maze->column[X] != -1 && maze->row[Y] != -1)
+        drawCandy(maze->column[X], maze->row[Y]);
+      ++X;
+    }
+    ++Y;
+  }
+  while (i < maze->powers) {
+    if (game->walls[maze->sprite[i][0]][maze->sprite[i][1]] == 1)
+      drawPower(maze->sprite[i][2], maze->sprite[i][3]);
+    ++i;
+  }
 }
 void drawCandy(int x, int y) {
   lineRGBA(game->screen, x, y, x + 1, y, 255, 255, 255, 255);
@@ -993,6 +1965,7 @@ void drawFruit() {
   SDL_BlitSurface(i, NULL, game->screen, &dest);
 }
 void drawHighscores() {
+  Board_read();
   SDL_Rect dest = { 38, 25, 0, 0 };
   SDL_BlitSurface(game->img->logo, NULL, game->screen, &dest);
   dest.x = 135;
@@ -1015,11 +1988,11 @@ void drawHighscores() {
     j = 0;
     while (j < 20) {
       dest.x += 15;
-      if (game->highscores[0][i][j] > 64 && game->highscores[0][i][j] < 91)
-        SDL_BlitSurface(getLetter(game->highscores[0][i][j]), NULL, game->screen, &dest);
+      if (game->scores[i].name[j] > 64 && game->scores[i].name[j] < 91)
+        SDL_BlitSurface(getLetter(game->scores[i].name[j]), NULL, game->screen, &dest);
       ++j;
     }
-    drawNumber(toInt(game->highscores[1][i]), dest.x, dest.y);
+    drawNumber(game->scores[i].score, dest.x, dest.y);
     ++i;
   }
 }
@@ -1049,6 +2022,14 @@ void drawMain() {
   SDL_BlitSurface(img, NULL, game->screen, &dest);
 }
 void drawMaze() {
+  if (game->background != NULL) {
+    SDL_BlitSurface(game->background, NULL, game->screen, NULL);
+    return;
+  }
+  if (game->maze->outline == 0) {
+    Maze_draw();
+    return;
+  }
   // top left
   lineRGBA(game->screen, 10, 0, 230, 0, MAZE_R, MAZE_G, MAZE_B, 255);
   arcRGBA(game->screen, 10, 10, 10, 180, 270, MAZE_R, MAZE_G, MAZE_B, 255);
@@ -1344,16 +2325,13 @@ void drawNewscorer() {
   unsigned int i = 0;
   dest.x = 100;
   dest.y = 200;
-  char *str = (char *) malloc(13 * sizeof(char));
-  while (i < sizeof game->highscores[0][10]) {
-    if (game->highscores[0][10][i] > 64 && game->highscores[0][10][i] < 91) {
-      snprintf(str, 13, "letter%d.png", game->highscores[0][10][i]);
+  while (i < sizeof game->scores[SCORES].name) {
+    if (game->scores[SCORES].name[i] > 64 && game->scores[SCORES].name[i] < 91) {
       dest.x += 15;
-      SDL_BlitSurface(getImage(str), NULL, game->screen, &dest);
+      SDL_BlitSurface(getLetter(game->scores[SCORES].name[i]), NULL, game->screen, &dest);
     }
     ++i;
   }
-  free(str);
 }
 void drawNumber(int score, int x, int y) {
   while (score != 0) {
@@ -1392,63 +2370,100 @@ void eraseScreen() {
   Uint32 black = SDL_MapRGB(game->screen->format, 0x00, 0x00, 0x00);
   SDL_FillRect(game->screen, &rect, black);
 }
+void Game_advance() {
+  if (game->paused == 1)
+    ;
+  else if (game->state == 0) {
+    if (game->headless == 0)
+      SDL_Delay(1000);
+    game->state = 1;
+  }
+  else if (game->state == 1) {
+    Game_tick();
+  }
+  else if (game->state == 2) {
+    if (game->frame - game->ticks >= DEATH_FRAMES)
+      game->state = 4;
+  }
+  else if (game->state == 3) {
+    if (game->headless == 0)
+      SDL_Delay(300);
+    game->bonus = 0;
+    game->state = 1;
+  }
+  else if (game->state == 4) {
+    if (game->headless == 0)
+      SDL_Delay(1000);
+    if (game->lives > 0)
+      game->state = 1;
+  }
+  else if (game->state == 9)
+    game->state = 0;
+}
+void Game_draw() {
+  SDL_Rect dest = { 170, 290, 0, 0 };
+  if (game->state == 0) {
+    SDL_BlitSurface(game->img->level, NULL, game->screen, &dest);
+    drawNumber(game->level, 260, 290);
+  }
+  else if ((game->state == 4 || game->state == 8) && game->lives < 1)
+    SDL_BlitSurface(game->img->gameover, NULL, game->screen, &dest);
+  else if (game->state == 4)
+    SDL_BlitSurface(game->img->getready, NULL, game->screen, &dest);
+  if (game->fruit == 1)
+    drawFruit();
+  drawBottom();
+  drawMaze();
+  drawCandies();
+  Pacman_draw();
+  if (game->state != 2)
+    Ghost_draw();
+  if (game->paused == 1)
+    SDL_BlitSurface(game->img->paused, NULL, game->screen, &dest);
+  if (game->state == 3)
+    drawBonus(game->pacman->x, game->pacman->y - 10);
+}
 void Game_init() {
   Game_new();
   game->delay = 100;
   game->state = 5;
   game->anim_index = 38;
   game->selected = 0;
-  char *str = (char *) malloc(11 * sizeof(char));
-  int i = 0;
-  while (i < 6) {
-    snprintf(str, 11, "candy%d.gif", i);
-    game->img->candy[i++] = getImage(str);
-  }
-  free(str);
+  int i;
   game->candy_index = 0;
   game->candy_blow_delay = 0;
+  game->replay = NULL;
+  game->headless = 0;
+  game->hashes = NULL;
   char *scores_file = (char *) malloc((strlen(getenv("HOME")) + 25) * sizeof(char));
-  snprintf(scores_file, strlen(getenv("HOME")) + 25, "%s/.puckman/highscores.txt", getenv("HOME"));
+  snprintf(scores_file, strlen(getenv("HOME")) + 25, "%s/.puckman/highscores.dat", getenv("HOME"));
   game->scores_file = scores_file;
-  FILE *f;
-  if ((f = fopen(game->scores_file, "r")) == NULL) {
-    if ((f = fopen(game->scores_file, "w")) == NULL) {
-      printf("Cannot open file %s\n", game->scores_file);
-      return;
+  char *replay_file = (char *) malloc((strlen(getenv("HOME")) + 22) * sizeof(char));
+  snprintf(replay_file, strlen(getenv("HOME")) + 22, "%s/.puckman/replay.dat", getenv("HOME"));
+  game->replay_file = replay_file;
+  char *save_file = (char *) malloc((strlen(getenv("HOME")) + 20) * sizeof(char));
+  snprintf(save_file, strlen(getenv("HOME")) + 20, "%s/.puckman/save.dat", getenv("HOME"));
+  game->save_file = save_file;
+  Score_load();
+  char *log_file = (char *) malloc((strlen(getenv("HOME")) + 22) * sizeof(char));
+  snprintf(log_file, strlen(getenv("HOME")) + 22, "%s/.puckman/scores.log", getenv("HOME"));
+  if (Rank_open(log_file) == 1) {
+    // the table of older versions starts the log
+    i = (game->ranking->count == 0) ? 0 : SCORES;
+    while (i < SCORES) {
+      if (game->scores[i].score > 0)
+        Rank_add(game->scores[i].name, game->scores[i].score);
+      ++i;
     }
-    i = 0;
-    while (i++ < 10)
-      fwrite("UNKNOWN            :0                  \n", 1, 40, f);
-    fclose(f);
+    Rank_view(game->scores, 1, SCORES);
   }
-  if ((f = fopen(game->scores_file, "r")) == NULL) {
-    printf("Cannot open file %s\n", game->scores_file);
-    return;
-  }
-  char c;
-  int j = 0, k = 0;
-  i = 0;
-  while ((c = fgetc(f)) != EOF)
-    switch (c) {
-      case ':':
-        k = 1;
-	j = 0;
-	break;
-      case '\n':
-        ++i;
-	j = 0;
-	k = 0;
-	break;
-      default:
-        game->highscores[k][i][j] = c;
-	++j;
-    }
-  fclose(f);
+  free(log_file);
+  Board_open();
+  Writer_start();
 }
 void Game_new() {
   game->running = 1;
   game->delay = 42;
-  game->speed = 7;
   game->score = 0;
   game->lives = 3;
   game->level = 0;
@@ -1457,41 +2472,36 @@ void Game_new() {
   game->paused = 0;
   game->fruit = 0;
   game->state = 9;
-  game->ticks_fruit = clock();
+  game->frame = 0;
+  game->ticks = 0;
+  game->ticks_fruit = 0;
+  game->collision->hits = 0;
   game->newscorer_index = 0;
-  snprintf(game->highscores[0][10], 20, "                   ");
+  snprintf(game->scores[SCORES].name, 20, "                   ");
 }
 void Game_process() {
-  int i = 0, j, eaten = 0;
-  while (i < 53) {
-    j = 0;
-    while (j < 46)
-      if (game->walls[i][j++] == 1)
-        break;
-    if (j != 46)
-      break;
-    ++i;
-  }
-  if (i == 53)
+  int i = 0, g, eaten = 0;
+  if (game->food_count == 0)
     game->state = 0;
-  i = 0;
-  while (i < 4) {
-    if ((game->ghosts->x >= game->pacman->x && game->ghosts->x <= game->pacman->x + 20 && game->pacman->y == game->ghosts->y) || (game->pacman->x >= game->ghosts->x && game->pacman->x <= game->ghosts->x + 20 && game->pacman->y == game->ghosts->y) || (game->ghosts->y >= game->pacman->y && game->ghosts->y <= game->pacman->y + 20 && game->pacman->x == game->ghosts->x) || (game->pacman->y >= game->ghosts->y && game->pacman->y <= game->ghosts->y + 20 && game->pacman->x == game->ghosts->x)) {
-      if (game->ghosts->state == 1 || game->ghosts->state == 2) {
-        game->state = 3;
-	Ghost_scare(game->ghosts, 3);
-      }
-      else if (game->ghosts->state == 0 && game->state == 1) {
-	game->ticks = clock();
-        game->state = 2;
-	game->fruit = 0;
-	game->ticks_fruit = clock();
-      }
+  while (i < game->collision->hits) {
+    g = game->collision->hit[i++];
+    if (game->ghosts->state[g] == 1 || game->ghosts->state[g] == 2) {
+      game->state = 3;
+      Ghost_scare(g, 3);
     }
-    if (game->ghosts->state == 3)
+    else if (game->ghosts->state[g] == 0 && game->state == 1) {
+      game->ticks = game->frame;
+      game->state = 2;
+      game->fruit = 0;
+      game->ticks_fruit = game->frame;
+    }
+  }
+  game->collision->hits = 0;
+  g = 0;
+  while (g < 4) {
+    if (game->ghosts->state[g] == 3)
      ++eaten;
-    ++i;
-    game->ghosts = game->ghosts->next;
+    ++g;
   }
   if (game->state == 3)
     game->bonus = 100 * (int) pow(2, eaten);
@@ -1504,493 +2514,1429 @@ void Game_process() {
     game->state = 3;
   }
 }
-SDL_Surface *getImage(char *str) {
-  int size = strlen("images/") + strlen(str) + strlen(PACPATH) + 1;
-  char *path = (char *) malloc(size * sizeof(char));
-  snprintf(path, size, "%simages/%s", PACPATH, str);
-  SDL_Surface *image = IMG_Load(path);
-  if (!image) {
-    printf("IMG_Load: %s\n", IMG_GetError());
-    cleanUp(1);
+int Game_speed(int kind) {
+  int band = (game->level <= 1) ? 0 : (game->level <= 4) ? 1 : (game->level <= 20) ? 2 : 3;
+  return speeds[band][kind];
+}
+void Game_step() {
+  ++(game->frame);
+  Game_process();
+  if (game->state != 1) {
+    game->fruit = 0;
+    game->ticks_fruit = game->frame;
+  }
+  if (game->state == 0) {
+    ++(game->level);
+    raiseWalls();
+    Pacman_init();
+    Ghost_init();
+  }
+  else if (game->state == 4) {
+    --(game->lives);
+    Pacman_init();
+    Ghost_init();
+    if (game->lives == -2) {
+      game->delay = 100;
+      game->state = 8;
+    }
+  }
+  if (game->state == 1 && game->frame - game->ticks_fruit >= FRUIT_FRAMES) {
+    game->fruit ^= 1;
+    game->ticks_fruit = game->frame;
+  }
+  if (game->state == 3)
+    game->score += game->bonus;
+}
+void Game_tick() {
+  Pacman *pacman = game->pacman;
+  int i = 0, g = 0, moves, most, coast[4] = { 0, 0, 0, 0 };
+  pacman->speed = Game_speed(SPEED_PACMAN);
+  pacman->sub += pacman->speed;
+  moves = most = pacman->sub >> FIXED_SHIFT;
+  pacman->sub &= FIXED_ONE - 1;
+  while (g < 4) {
+    game->ghosts->speed[g] = Ghost_speed(g);
+    game->ghosts->sub[g] += game->ghosts->speed[g];
+    game->ghosts->steps[g] = game->ghosts->sub[g] >> FIXED_SHIFT;
+    game->ghosts->sub[g] &= FIXED_ONE - 1;
+    if (game->ghosts->steps[g] > most)
+      most = game->ghosts->steps[g];
+    ++g;
+  }
+  // the frightened timer only moves with the frame, so one look per tick does
+  if (most > 0)
+    Ghost_unscare();
+  // every entity takes its whole pixels of the tick, interleaved so contacts are seen as they happen
+  while (i < most) {
+    if (i < moves)
+      Pacman_move();
+    Ghost_move(moves - i, coast);
+    ++i;
+    // stop the tick at the first contact, Game_process settles it
+    if (Collision_check()) {
+      Ghost_rewind(coast);
+      break;
+    }
   }
-  free(path);
-  return image;
+}
+SDL_Surface *getImage(char *str) {
+  // on the main thread only: a missing image ends the game here
+  SDL_Surface *image = Image_read(str);
+  if (image == NULL)
+    exit(cleanUp(1));
+  return Image_convert(image);
 }
 SDL_Surface *getLetter(int letter) {
-  char *str = (char *) malloc(13 * sizeof(char));
-  snprintf(str, 13, "letter%d.png", letter);
-  SDL_Surface *image = getImage(str);
-  free(str);
-  return image;
+  return game->img->letters[letter - 65];
 }
-void Ghost_chase(Ghost *ghost) {
-  switch (ghost->id) {
+int Ghost_aim(int g, int x, int y) {
+  Nav *nav = game->nav;
+  int Y = game->ghosts->y[g] / 10, X = game->ghosts->x[g] / 10, dir = 0, best = -1, target, tile, yy, xx;
+  if (game->ghosts->x[g] % 10 != 0 || game->ghosts->y[g] % 10 != 0 || nav->tile_index[Y][X] == -1)
+    return 0;
+  int exits = nav->exits[Nav_kind(g)][Y][X] & ~(1 << Nav_reverse(game->ghosts->dir[g]));
+  Uint8 dist = NAV_NEAR_FAR, *distance = game->tables + nav->distance;
+  target = Nav_nearest(game, x, y);
+  while (dir < 4) {
+    // only an open exit is stepped through, a closed one may lead out of the maze
+    if (exits & (1 << dir)) {
+      yy = Y;
+      xx = X;
+      Nav_step(game->maze, &yy, &xx, dir);
+      tile = nav->tile_index[yy][xx];
+      if (tile != -1 && distance[tile * nav->tiles + target] < dist) {
+        best = dir;
+        dist = distance[tile * nav->tiles + target];
+      }
+    }
+    ++dir;
+  }
+  if (best == -1)
+    return 0;
+  game->ghosts->dir[g] = best;
+  return Ghost_forward(g);
+}
+void Ghost_chase(int g) {
+  // each rule is known at compile time, its target is inlined into its Ghost_steer
+  switch (g) {
     case BLINKY:
-      Blinky_chase(ghost);
+      Ghost_steer<Blinky>(g);
       break;
     case PINKY:
-      Pinky_chase(ghost);
+      Ghost_steer<Pinky>(g);
       break;
     case INKY:
-      Inky_chase(ghost);
+      Ghost_steer<Inky>(g);
       break;
-    case CLYDE:
-      Clyde_chase(ghost);
-  }
-}
-void Ghost_checkWay(Ghost *ghost) {
-  ghost->ways[RIGHT] = 0;
-  ghost->ways[LEFT] = 0;
-  ghost->ways[UP] = 0;
-  ghost->ways[DOWN] = 0;
-  int XX = (int) ghost->x / 10;
-  int YY = (int) ghost->y / 10;
-  if (ghost->y % 10 == 0) {
-    int Y = YY;
-    int X = XX + 3;
-    if (game->walls[Y++][X] != -1 && game->walls[Y++][X] != -1 && game->walls[Y][X] != -1)
-      ghost->ways[RIGHT] = 1;
-    Y = YY;
-    X = XX - 1;
-    if (game->walls[Y++][X] != -1 && game->walls[Y++][X] != -1 && game->walls[Y][X] != -1)
-      ghost->ways[LEFT] = 1;
-  }
-  if (ghost->x % 10 == 0) {
-    int Y = YY - 1;
-    int X = XX;
-    if ((Y == 20 && (X == 21 || X == 22)) || (game->walls[Y][X++] != -1 && game->walls[Y][X++] != -1 && game->walls[Y][X] != -1))
-      ghost->ways[UP] = 1;
-    X = XX;
-    Y = Y + 3;
-    if ((ghost->state == 3 && Y == 20 && X == 22) || (game->walls[Y][X++] != -1 && game->walls[Y][X++] != -1 && game->walls[Y][X] != -1))
-      ghost->ways[DOWN] = 1;
-  }
- switch (ghost->dir) {
-   case RIGHT:
-     ghost->ways[LEFT] = 0;
-     break;
-   case LEFT:
-     ghost->ways[RIGHT] = 0;
-     break;
-   case UP:
-     ghost->ways[DOWN] = 0;
-     break;
-   case DOWN:
-     ghost->ways[UP] = 0;
- }
+    default:
+      Ghost_steer<Clyde>(g);
+  }
+}
+void Ghost_checkWay(int g) {
+  int ways = Nav_ways(Nav_kind(g), game->ghosts->x[g], game->ghosts->y[g]) & ~(1 << Nav_reverse(game->ghosts->dir[g]));
+  game->ghosts->ways[g][RIGHT] = (ways >> RIGHT) & 1;
+  game->ghosts->ways[g][LEFT] = (ways >> LEFT) & 1;
+  game->ghosts->ways[g][UP] = (ways >> UP) & 1;
+  game->ghosts->ways[g][DOWN] = (ways >> DOWN) & 1;
 }
 void Ghost_draw() {
   SDL_Rect dest;
   dest.w = 0;
   dest.h = 0;
   SDL_Surface *image;
-  int i = 0;
-  while (i < 4) {
-    dest.x = (game->ghosts->dir == UP || game->ghosts->dir == DOWN) ? (game->ghosts->x + 1) : game->ghosts->x;
-    dest.y = (game->ghosts->dir == RIGHT || game->ghosts->dir == LEFT) ? (game->ghosts->y + 1) : game->ghosts->y;
-    switch (game->ghosts->state) {
+  int g = 0;
+  while (g < 4) {
+    dest.x = (game->ghosts->dir[g] == UP || game->ghosts->dir[g] == DOWN) ? (game->ghosts->x[g] + 1) : game->ghosts->x[g];
+    dest.y = (game->ghosts->dir[g] == RIGHT || game->ghosts->dir[g] == LEFT) ? (game->ghosts->y[g] + 1) : game->ghosts->y[g];
+    switch (game->ghosts->state[g]) {
       case 0:
-        image = game->ghosts->image[game->ghosts->dir][game->ghosts->image_index];
+        image = game->ghosts->image[g][game->ghosts->dir[g]][game->ghosts->image_index[g]];
 	break;
       case 1:
-        image = game->ghosts->scared[game->ghosts->image_index];
+        image = game->ghosts->scared[game->ghosts->image_index[g]];
 	break;
       case 2:
-        image = game->ghosts->scared2[game->ghosts->image_index];
+        image = game->ghosts->scared2[game->ghosts->image_index[g]];
         break;
       case 3:
-        image = game->ghosts->eyes[game->ghosts->dir];
+        image = game->ghosts->eyes[game->ghosts->dir[g]];
 	break;
       case 4:
-        image = game->ghosts->image[game->ghosts->dir][game->ghosts->image_index];
+        image = game->ghosts->image[g][game->ghosts->dir[g]][game->ghosts->image_index[g]];
     }
     SDL_BlitSurface(image, NULL, game->screen, &dest);
-    if (game->ghosts->state == 2) {
-      ++(game->ghosts->image_index);
-      if (game->ghosts->image_index == 8)
-        game->ghosts->image_index = 0;
+    if (game->ghosts->state[g] == 2) {
+      ++(game->ghosts->image_index[g]);
+      if (game->ghosts->image_index[g] == 8)
+        game->ghosts->image_index[g] = 0;
     }
     else
-      game->ghosts->image_index ^= 1;
-    ++i;
-    game->ghosts = game->ghosts->next;
-  }
-}
-void Ghost_goHome(Ghost *ghost) {
-  int x = 220, y = 170;
-  if (y < ghost->y && ghost->ways[UP] == 1 && Ghost_moveUp(ghost) == 1)
-    ghost->dir = UP;
-  else if (x > ghost->x && ghost->ways[RIGHT] == 1 && Ghost_moveRight(ghost) == 1)
-    ghost->dir = RIGHT;
-  else if (y > ghost->y && ghost->ways[DOWN] == 1 && Ghost_moveDown(ghost) == 1)
-    ghost->dir = DOWN;
-  else if (x < ghost->x && ghost->ways[LEFT] == 1 && Ghost_moveLeft(ghost) == 1)
-    ghost->dir = LEFT;
-  else if (ghost->dir == LEFT && Ghost_moveLeft(ghost) == 0) {
-    if (y >= ghost->y && ghost->ways[DOWN] == 1 && Ghost_moveDown(ghost) == 1)
-      ghost->dir = DOWN;
-    else if (ghost->ways[UP] == 1 && Ghost_moveUp(ghost) == 1)
-      ghost->dir = UP;
-    else {
-      ghost->dir = DOWN;
-      Ghost_moveDown(ghost);
-    }
-  }
-  else if (ghost->dir == DOWN && Ghost_moveDown(ghost) == 0) {
-    if (x >= ghost->x && ghost->ways[RIGHT] == 1 && Ghost_moveRight(ghost) == 1)
-      ghost->dir = RIGHT;
-    else if (ghost->ways[LEFT] == 1 && Ghost_moveLeft(ghost) == 1)
-      ghost->dir = LEFT;
-    else {
-      ghost->dir = RIGHT;
-      Ghost_moveRight(ghost);
-    }
+      game->ghosts->image_index[g] ^= 1;
+    ++g;
   }
-  else if (ghost->dir == RIGHT && Ghost_moveRight(ghost) == 0) {
-    if (y >= ghost->y && ghost->ways[DOWN] == 1 && Ghost_moveDown(ghost) == 1)
-      ghost->dir = DOWN;
-    else if (ghost->ways[UP] == 1 && Ghost_moveUp(ghost) == 1)
-      ghost->dir = UP;
-    else {
-      ghost->dir = DOWN;
-      Ghost_moveDown(ghost);
+}
+int Ghost_flow(int g, Uint16 field[MAZE_HEIGHT][MAZE_WIDTH], int flee) {
+  int Y = game->ghosts->y[g] / 10, X = game->ghosts->x[g] / 10, dir = 0, best = -1, y, x;
+  if (game->ghosts->x[g] % 10 != 0 || game->ghosts->y[g] % 10 != 0)
+    return 0;
+  if (field == game->chase)
+    Nav_chase();
+  if (field[Y][X] == 0 || field[Y][X] == NAV_FAR)
+    return 0;
+  int exits = game->nav->exits[Nav_kind(g)][Y][X] & ~(1 << Nav_reverse(game->ghosts->dir[g]));
+  Uint16 dist = 0;
+  while (dir < 4) {
+    y = Y;
+    x = X;
+    Nav_step(game->maze, &y, &x, dir);
+    if ((exits & (1 << dir)) && field[y][x] != NAV_FAR && (best == -1 || (flee ? field[y][x] > dist : field[y][x] < dist))) {
+      best = dir;
+      dist = field[y][x];
     }
+    ++dir;
   }
-  else if (ghost->dir == UP && Ghost_moveUp(ghost) == 0) {
-    if (x >= ghost->x && ghost->ways[RIGHT] == 1 && Ghost_moveRight(ghost) == 1)
-      ghost->dir = RIGHT;
-    else if (ghost->ways[LEFT] == 1 && Ghost_moveLeft(ghost) == 1)
-      ghost->dir = LEFT;
-    else {
-      ghost->dir = RIGHT;
-      Ghost_moveRight(ghost);
-    }
+  if (best == -1)
+    return 0;
+  game->ghosts->dir[g] = best;
+  return Ghost_forward(g);
+}
+int Ghost_follow(int g) {
+  int choices;
+  if (game->ghosts->x[g] % 10 != 0 || game->ghosts->y[g] % 10 != 0)
+    choices = Nav_canMove(Nav_kind(g), game->ghosts->x[g], game->ghosts->y[g], game->ghosts->dir[g]) << game->ghosts->dir[g];
+  else
+    choices = game->nav->exits[Nav_kind(g)][game->ghosts->y[g] / 10][game->ghosts->x[g] / 10] & 15 & ~(1 << Nav_reverse(game->ghosts->dir[g]));
+  if (choices == 0 || (choices & (choices - 1)) != 0)
+    return 0;
+  game->ghosts->dir[g] = Nav_dir(choices);
+  return Ghost_forward(g);
+}
+int Ghost_forward(int g) {
+  switch (game->ghosts->dir[g]) {
+    case RIGHT:
+      return Ghost_moveRight(g);
+    case LEFT:
+      return Ghost_moveLeft(g);
+    case UP:
+      return Ghost_moveUp(g);
+    default:
+      return Ghost_moveDown(g);
   }
-  if (ghost->x == 220 && ghost->y == 170)
-    ghost->dir = DOWN;
+}
+int Ghost_glide(int g, int ahead, int coast[4]) {
+  Ghosts *ghosts = game->ghosts;
+  int x = ghosts->x[g], y = ghosts->y[g], dir = ghosts->dir[g], run, far;
+  // between two tiles there is nothing to decide but going on, so the ghost takes the rest of the segment at once
+  if (ghosts->state[g] == 4 || Maze_tunnel(game->pacman->y) || Nav_canMove(Nav_kind(g), x, y, dir) == 0)
+    return 0;
+  // Inky aims off Blinky, so Blinky keeps to the pixel while Inky has a decision left this tick
+  if (g == BLINKY && ghosts->steps[INKY] > 0)
+    return 0;
+  if (dir == RIGHT || dir == LEFT)
+    run = (y % 10 != 0 || x % 10 == 0) ? 0 : (dir == RIGHT) ? 10 - x % 10 : x % 10;
+  else
+    run = (x % 10 != 0 || y % 10 == 0) ? 0 : (dir == DOWN) ? 10 - y % 10 : y % 10;
+  // the tunnel wraps before the end of its last tile
+  if (dir == RIGHT && Maze_tunnel(y) && x + run > game->maze->wrap[1])
+    run = game->maze->wrap[1] - x;
+  run = (run > ghosts->steps[g]) ? ghosts->steps[g] : run;
+  // and only out of reach of Pac-Man, so that no contact falls between the pixels skipped
+  far = run + ahead + COLLISION_REACH;
+  if (run < 2 || (abs(x - game->pacman->x) <= far && abs(y - game->pacman->y) <= far))
+    return 0;
+  ghosts->x[g] += (dir == RIGHT) ? run : (dir == LEFT) ? -run : 0;
+  ghosts->y[g] += (dir == DOWN) ? run : (dir == UP) ? -run : 0;
+  // the passes of the pixels taken ahead go by without a move
+  coast[g] = run - 1;
+  return 1;
+}
+int Ghost_greedy(int g, int x, int y) {
+  if (x == game->ghosts->x[g] && y > game->ghosts->y[g] && game->ghosts->ways[g][DOWN] == 1 && Ghost_moveDown(g) == 1)
+    game->ghosts->dir[g] = DOWN;
+  else if (y == game->ghosts->y[g] && x < game->ghosts->x[g] && game->ghosts->ways[g][LEFT] == 1 && Ghost_moveLeft(g) == 1)
+    game->ghosts->dir[g] = LEFT;
+  else if (x == game->ghosts->x[g] && y < game->ghosts->y[g] && game->ghosts->ways[g][UP] == 1 && Ghost_moveUp(g) == 1)
+    game->ghosts->dir[g] = UP;
+  else if (y == game->ghosts->y[g] && x > game->ghosts->x[g] && game->ghosts->ways[g][RIGHT] == 1 && Ghost_moveRight(g) == 1)
+    game->ghosts->dir[g] = RIGHT;
+  else if (x > game->ghosts->x[g] && game->ghosts->ways[g][RIGHT] == 1 && Ghost_moveRight(g) == 1)
+    game->ghosts->dir[g] = RIGHT;
+  else if (y > game->ghosts->y[g] && game->ghosts->ways[g][DOWN] == 1 && Ghost_moveDown(g) == 1)
+    game->ghosts->dir[g] = DOWN;
+  else if (x < game->ghosts->x[g] && game->ghosts->ways[g][LEFT] == 1 && Ghost_moveLeft(g) == 1)
+    game->ghosts->dir[g] = LEFT;
+  else if (y < game->ghosts->y[g] && game->ghosts->ways[g][UP] == 1 && Ghost_moveUp(g) == 1)
+    game->ghosts->dir[g] = UP;
+  else
+    return 0;
+  return 1;
 }
 void Ghost_init() {
-  int i = 0;
-  while (i < 4) {
-    game->ghosts->id = i;
-    switch (i) {
+  int g = 0;
+  while (g < 4) {
+    switch (g) {
       case BLINKY:
-        game->ghosts->x = 217;
-	game->ghosts->y = 170;
-	game->ghosts->dir = LEFT;
-	game->ghosts->state = 0;
+        game->ghosts->x[g] = 217;
+	game->ghosts->y[g] = 170;
+	game->ghosts->dir[g] = LEFT;
+	game->ghosts->state[g] = 0;
         break;
       case PINKY:
-        game->ghosts->x = 220;
-	game->ghosts->y = 250;
-	game->ghosts->dir = UP;
-	game->ghosts->state = 4;
+        game->ghosts->x[g] = 220;
+	game->ghosts->y[g] = 250;
+	game->ghosts->dir[g] = UP;
+	game->ghosts->state[g] = 4;
         break;
       case INKY:
-        game->ghosts->x = 190;
-	game->ghosts->y = 250;
-	game->ghosts->dir = UP;
-	game->ghosts->state = 4;
-	game->ghosts->initloop = 0;
+        game->ghosts->x[g] = 190;
+	game->ghosts->y[g] = 250;
+	game->ghosts->dir[g] = UP;
+	game->ghosts->state[g] = 4;
+	game->ghosts->initloop[g] = 0;
         break;
       case CLYDE:
-        game->ghosts->x = 250;
-	game->ghosts->y = 250;
-	game->ghosts->dir = LEFT;
-	game->ghosts->state = 4;
-	game->ghosts->initloop = 0;
-    }
-    Ghost_load(game->ghosts);
-    game->ghosts->image_index = 0;
-    game->ghosts->lowspeed = 0;
-    ++i;
-    game->ghosts = game->ghosts->next;
+        game->ghosts->x[g] = 250;
+	game->ghosts->y[g] = 250;
+	game->ghosts->dir[g] = LEFT;
+	game->ghosts->state[g] = 4;
+	game->ghosts->initloop[g] = 0;
+    }
+    game->ghosts->image_index[g] = 0;
+    game->ghosts->sub[g] = 0;
+    game->ghosts->steps[g] = 0;
+    ++g;
   }
+  Collision_reset();
 }
-void Ghost_load(Ghost *ghost) {
+void Ghost_load() {
   char *str = (char *) malloc(13 * sizeof(char));
-  int i = 0, j;
-  while (i < 4) {
-    j = 0;
-    while (j < 2) {
-      snprintf(str, 13, "ghost%d%d%d.gif", ghost->id, i, j);
-      ghost->image[i][j++] = getImage(str);
+  int g = 0, i, j;
+  while (g < 4) {
+    i = 0;
+    while (i < 4) {
+      j = 0;
+      while (j < 2) {
+        snprintf(str, 13, "ghost%d%d%d.gif", g, i, j);
+        game->ghosts->image[g][i][j++] = Asset_get(str);
+      }
+      ++i;
     }
-    ++i;
+    ++g;
   }
   j = 0;
   while (j < 2) {
     snprintf(str, 13, "scared0%d.gif", j);
-    ghost->scared[j++] = getImage(str);
+    game->ghosts->scared[j++] = Asset_get(str);
   }
   j = 0;
   while (j < 8) {
     snprintf(str, 13, "scared1%d.gif", j);
-    ghost->scared2[j++] = getImage(str);
+    game->ghosts->scared2[j++] = Asset_get(str);
   }
   free(str);
   str = (char *) malloc(10 * sizeof(char));
   j = 0;
   while (j < 4) {
     snprintf(str, 10, "eyes%d.png", j);
-    ghost->eyes[j++] = getImage(str);
+    game->ghosts->eyes[j++] = Asset_get(str);
   }
   free(str);
 }
-void Ghost_move() {
-  Ghost_unscare();
-  int i = 0;
-  while (i < 4) {
-    Ghost_checkWay(game->ghosts);
-    if (game->ghosts->state == 3) {
-      if (game->ghosts->x == 220 && game->ghosts->y == 200) {
-        game->ghosts->dir = UP;
-        game->ghosts->state = 0;
-      }
-      Ghost_goHome(game->ghosts);
-    }
-    else if (game->ghosts->state == 4) {
-      if (game->ghosts->id == PINKY) {
-        if (game->ghosts->ways[UP] == 1 && Ghost_moveUp(game->ghosts) == 1)
-          game->ghosts->dir = UP;
-        else {
-          game->ghosts->state = 0;
-	  Ghost_chase(game->ghosts);
+void Ghost_move(int ahead, int coast[4]) {
+  int g = 0;
+  while (g < 4) {
+    // out of whole pixels for this tick, already ahead, or along a corridor where there is nothing to decide
+    if (game->ghosts->steps[g] == 0)
+      ;
+    else if (coast[g] > 0)
+      --coast[g];
+    else if (Ghost_glide(g, ahead, coast))
+      ;
+    else {
+      Ghost_checkWay(g);
+      if (game->ghosts->state[g] == 3) {
+        if (game->ghosts->x[g] == game->maze->home[1] * 10 && game->ghosts->y[g] == (game->maze->home[0] + 3) * 10) {
+          game->ghosts->dir[g] = UP;
+          game->ghosts->state[g] = 0;
         }
+        if (Ghost_follow(g) == 0)
+          Ghost_steer<Home>(g);
+        if (game->ghosts->x[g] == game->maze->home[1] * 10 && game->ghosts->y[g] == game->maze->home[0] * 10)
+          game->ghosts->dir[g] = DOWN;
       }
-      else if (game->ghosts->id == INKY || game->ghosts->id == CLYDE) {
-        int i = (game->ghosts->id == INKY) ? 3 : 5;
-        if (game->ghosts->initloop < i) {
-	  if (game->ghosts->dir == UP) {
-	    if (Ghost_moveUp(game->ghosts) == 0) {
-	      game->ghosts->dir = DOWN;
-	      Ghost_moveDown(game->ghosts);
-	      ++(game->ghosts->initloop);
+      else if (game->ghosts->state[g] == 4) {
+        if (g == PINKY) {
+          if (game->ghosts->ways[g][UP] == 1 && Ghost_moveUp(g) == 1)
+            game->ghosts->dir[g] = UP;
+          else {
+            game->ghosts->state[g] = 0;
+	    Ghost_chase(g);
+          }
+        }
+        else if (g == INKY || g == CLYDE) {
+          int i = (g == INKY) ? 3 : 5;
+          if (game->ghosts->initloop[g] < i) {
+	    if (game->ghosts->dir[g] == UP) {
+	      if (Ghost_moveUp(g) == 0) {
+	        game->ghosts->dir[g] = DOWN;
+	        Ghost_moveDown(g);
+	        ++(game->ghosts->initloop[g]);
+	      }
+	    }
+	    else {
+	      if (Ghost_moveDown(g) == 0) {
+	        game->ghosts->dir[g] = UP;
+	        Ghost_moveUp(g);
+	      }
 	    }
 	  }
+	  else if (game->ghosts->x[g] != game->maze->home[1] * 10)
+	    (g == INKY) ? Ghost_moveRight(g) : Ghost_moveLeft(g);
+	  else if (game->ghosts->y[g] != game->maze->home[0] * 10)
+	    Ghost_moveUp(g);
 	  else {
-	    if (Ghost_moveDown(game->ghosts) == 0) {
-	      game->ghosts->dir = UP;
-	      Ghost_moveUp(game->ghosts);
-	    }
+	    game->ghosts->state[g] = 0;
+	    Ghost_chase(g);
 	  }
-	}
-	else if (game->ghosts->x != 220)
-	  (game->ghosts->id == INKY) ? Ghost_moveRight(game->ghosts) : Ghost_moveLeft(game->ghosts);
-	else if (game->ghosts->y != 170)
-	  Ghost_moveUp(game->ghosts);
-	else {
-	  game->ghosts->state = 0;
-	  Ghost_chase(game->ghosts);
-	}
+        }
       }
+      else if (Ghost_follow(g) == 0)
+        Ghost_chase(g);
+    }
+    if (game->ghosts->steps[g] > 0)
+      --(game->ghosts->steps[g]);
+    ++g;
+  }
+}
+int Ghost_moveDown(int g) {
+  if (Nav_canMove(Nav_kind(g), game->ghosts->x[g], game->ghosts->y[g], DOWN)) {
+    game->ghosts->y[g] += 1;
+    return 1;
+  }
+  return 0;
+}
+int Ghost_moveLeft(int g) {
+  if (game->ghosts->x[g] == game->maze->wrap[0] && Maze_tunnel(game->ghosts->y[g]))
+    game->ghosts->x[g] = game->maze->wrap[2];
+  else if (Nav_canMove(Nav_kind(g), game->ghosts->x[g], game->ghosts->y[g], LEFT))
+    game->ghosts->x[g] -= 1;
+  else
+    return 0;
+  return 1;
+}
+int Ghost_moveRight(int g) {
+  if (game->ghosts->x[g] == game->maze->wrap[1] && Maze_tunnel(game->ghosts->y[g]))
+    game->ghosts->x[g] = game->maze->wrap[0];
+  else if (Nav_canMove(Nav_kind(g), game->ghosts->x[g], game->ghosts->y[g], RIGHT))
+    game->ghosts->x[g] += 1;
+  else
+    return 0;
+  return 1;
+}
+int Ghost_moveUp(int g) {
+  if (Nav_canMove(Nav_kind(g), game->ghosts->x[g], game->ghosts->y[g], UP)) {
+    game->ghosts->y[g] -= 1;
+    return 1;
+  }
+  return 0;
+}
+void Ghost_rewind(int coast[4]) {
+  Ghosts *ghosts = game->ghosts;
+  int g = 0;
+  // a tick cut short leaves the ghosts that glided where their pixels so far would have
+  while (g < 4) {
+    ghosts->x[g] -= (ghosts->dir[g] == RIGHT) ? coast[g] : (ghosts->dir[g] == LEFT) ? -coast[g] : 0;
+    ghosts->y[g] -= (ghosts->dir[g] == DOWN) ? coast[g] : (ghosts->dir[g] == UP) ? -coast[g] : 0;
+    game->collision->from[g + 1][0] = ghosts->x[g];
+    game->collision->from[g + 1][1] = ghosts->y[g];
+    ++g;
+  }
+}
+void Ghost_scare(int g, int s) {
+  if ((game->ghosts->state[g] == 2 && s == 0) || (s == 2 && game->ghosts->state[g] == 1) || (game->ghosts->state[g] == 2 && s == 1) || (s == 1 && game->ghosts->state[g] == 0) || (s == 3 && (game->ghosts->state[g] == 1 || game->ghosts->state[g] == 2)))
+    game->ghosts->state[g] = s;
+  if (s != 2)
+    game->ghosts->image_index[g] = 0;
+}
+int Ghost_speed(int g) {
+  if (game->ghosts->state[g] == 3)
+    return Game_speed(SPEED_EYES);
+  // the side corridors of the tunnel rows, past the junctions the maze gives
+  if (Maze_tunnel(game->ghosts->y[g]) && (game->ghosts->x[g] < game->maze->slow[0] || game->ghosts->x[g] > game->maze->slow[1]))
+    return Game_speed(SPEED_TUNNEL);
+  if (game->ghosts->state[g] == 1 || game->ghosts->state[g] == 2)
+    return Game_speed(SPEED_FRIGHTENED);
+  return Game_speed(SPEED_GHOST);
+}
+template <typename Rule> void Ghost_steer(int g) {
+  int x, y, aim = Rule::target(g, &x, &y);
+  if (game->ghosts->state[g] == 3) {
+    if (Ghost_flow(g, game->nav->home, 0))
+      return;
+  }
+  else if (game->ghosts->state[g] == 1 || game->ghosts->state[g] == 2) {
+    if (Ghost_flow(g, game->chase, 1))
+      return;
+    x = SCREEN_WIDTH - x;
+    y = SCREEN_HEIGHT - y;
+  }
+  else if (aim && Ghost_aim(g, x, y))
+    return;
+  if (aim == 0 || Ghost_greedy(g, x, y) == 0)
+    Ghost_turn(g, x, y);
+}
+void Ghost_turn(int g, int x, int y) {
+  if (game->ghosts->dir[g] == LEFT && Ghost_moveLeft(g) == 0) {
+    if (y >= game->ghosts->y[g] && game->ghosts->ways[g][DOWN] == 1 && Ghost_moveDown(g) == 1)
+      game->ghosts->dir[g] = DOWN;
+    else if (game->ghosts->ways[g][UP] == 1 && Ghost_moveUp(g) == 1)
+      game->ghosts->dir[g] = UP;
+    else {
+      game->ghosts->dir[g] = DOWN;
+      Ghost_moveDown(g);
+    }
+  }
+  else if (game->ghosts->dir[g] == DOWN && Ghost_moveDown(g) == 0) {
+    if (x >= game->ghosts->x[g] && game->ghosts->ways[g][RIGHT] == 1 && Ghost_moveRight(g) == 1)
+      game->ghosts->dir[g] = RIGHT;
+    else if (game->ghosts->ways[g][LEFT] == 1 && Ghost_moveLeft(g) == 1)
+      game->ghosts->dir[g] = LEFT;
+    else {
+      game->ghosts->dir[g] = RIGHT;
+      Ghost_moveRight(g);
     }
-    else if (game->ghosts->state == 1 || game->ghosts->state == 2) {
-      if (game->ghosts->lowspeed == 1)
-        Ghost_chase(game->ghosts);
-      game->ghosts->lowspeed ^= 1;
+  }
+  else if (game->ghosts->dir[g] == RIGHT && Ghost_moveRight(g) == 0) {
+    if (y >= game->ghosts->y[g] && game->ghosts->ways[g][DOWN] == 1 && Ghost_moveDown(g) == 1)
+      game->ghosts->dir[g] = DOWN;
+    else if (game->ghosts->ways[g][UP] == 1 && Ghost_moveUp(g) == 1)
+      game->ghosts->dir[g] = UP;
+    else {
+      game->ghosts->dir[g] = DOWN;
+      Ghost_moveDown(g);
+    }
+  }
+  else if (game->ghosts->dir[g] == UP && Ghost_moveUp(g) == 0) {
+    if (x >= game->ghosts->x[g] && game->ghosts->ways[g][RIGHT] == 1 && Ghost_moveRight(g) == 1)
+      game->ghosts->dir[g] = RIGHT;
+    else if (game->ghosts->ways[g][LEFT] == 1 && Ghost_moveLeft(g) == 1)
+      game->ghosts->dir[g] = LEFT;
+    else {
+      game->ghosts->dir[g] = RIGHT;
+      Ghost_moveRight(g);
     }
-    else
-      Ghost_chase(game->ghosts);
-    ++i;
-    game->ghosts = game->ghosts->next;
   }
 }
-int Ghost_moveDown(Ghost *ghost) {
-  int Y = (int) ghost->y / 10 + 3;
-  int X = (int) ghost->x / 10;
-  if ((ghost->state == 3 && Y == 20 && X == 22) || (game->walls[Y][X++] != -1 && game->walls[Y][X++] != -1 && game->walls[Y][X] != -1)) {
-    ghost->y += 1;
+void Ghost_unscare() {
+  Uint32 elapsed = game->frame - game->ticks;
+  Ghosts *ghosts = game->ghosts;
+  // same rules as Ghost_scare with 2 after FLASH_FRAMES and 0 after FRIGHT_FRAMES, over all ghosts at once
+  int g = 0, s = (elapsed >= FRIGHT_FRAMES) ? 0 : (elapsed >= FLASH_FRAMES) ? 2 : -1, frightened;
+  while (g < 4) {
+    frightened = ghosts->state[g] == 1 || ghosts->state[g] == 2;
+    ghosts->image_index[g] = (frightened && s == 0) ? 0 : ghosts->image_index[g];
+    ghosts->state[g] = (s == 0 && ghosts->state[g] == 2) ? 0 : (s == 2 && ghosts->state[g] == 1) ? 2 : ghosts->state[g];
+    ++g;
+  }
+}
+int Gym_bench(const char *path, Uint32 steps, int frames) {
+  struct sockaddr_un address;
+  GymRequest request;
+  GymReply reply;
+  Uint32 i = 0, resets = 0, seed = 1, score = 0;
+  int fd;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 || connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+    fprintf(stderr, "Could not connect to %s\n", path);
+    return 1;
+  }
+  memset(&request, 0, sizeof(request));
+  request.op = GYM_RESET;
+  if (Gym_write(fd, &request, sizeof(request)) == 0 || Gym_read(fd, &reply, sizeof(reply)) == 0)
     return 1;
+  request.frames = frames;
+  game->bench = 1;
+  Bench_mark(NULL);
+  while (i < steps) {
+    // a new random direction every 8 steps or so
+    seed = seed * 1103515245 + 12345;
+    if ((seed >> 16) % 8 == 0)
+      request.action = (seed >> 20) % 4;
+    request.op = (reply.done == 1) ? GYM_RESET : GYM_STEP;
+    resets += reply.done;
+    if (Gym_write(fd, &request, sizeof(request)) == 0 || Gym_read(fd, &reply, sizeof(reply)) == 0)
+      return 1;
+    score += reply.reward;
+    ++i;
   }
+  Bench_mark("steps");
+  printf("steps %u frames %d resets %u score %u: %.0f steps/s\n", steps, frames, resets, score, steps / ((game->bench_last - game->bench_start) / 1e9));
+  request.op = GYM_CLOSE;
+  Gym_write(fd, &request, sizeof(request));
+  close(fd);
   return 0;
 }
-int Ghost_moveLeft(Ghost *ghost) {
-  if (ghost->x == 10 && ghost->y == 230)
-    ghost->x = 425;
-  else {
-    int Y = (int) ghost->y / 10;
-    int X = (int) (ghost->x - 1) / 10;
-    if (game->walls[Y++][X] != -1 && game->walls[Y++][X] != -1 && game->walls[Y][X] != -1)
-      ghost->x -= 1;
-    else
+int Gym_read(int fd, void *data, size_t size) {
+  ssize_t n;
+  while (size > 0) {
+    if ((n = read(fd, data, size)) <= 0)
       return 0;
+    data = (char *) data + n;
+    size -= n;
   }
   return 1;
 }
-int Ghost_moveRight(Ghost *ghost) {
-  if (ghost->x == 429 && ghost->y == 230)
-    ghost->x = 10;
-  else {
-    int Y = (int) ghost->y / 10;
-    int X = (int) ghost->x / 10 + 3;
-    if (game->walls[Y++][X] != -1 && game->walls[Y++][X] != -1 && game->walls[Y][X] != -1)
-      ghost->x += 1;
-    else
-      return 0;
+void Gym_reset(GymReply *reply) {
+  // through the level start, up to the first frame Pac-Man can move in
+  Game_new();
+  while (game->state != 1) {
+    Game_advance();
+    Game_step();
   }
-  return 1;
+  reply->reward = 0;
+  reply->done = 0;
+  Observation_take(&reply->observation, game);
 }
-int Ghost_moveUp(Ghost *ghost) {
-  int Y = (int) (ghost->y - 1) / 10;
-  int X = (int) ghost->x / 10;
-  if ((Y == 20 && (X == 21 || X == 22)) || (game->walls[Y][X++] != -1 && game->walls[Y][X++] != -1 && game->walls[Y][X] != -1)) {
-    ghost->y -= 1;
+int Gym_serve(const char *path) {
+  struct sockaddr_un address;
+  GymRequest request;
+  GymReply reply;
+  int server, client, open;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return 1;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+  unlink(path);
+  if ((server = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 || bind(server, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(server, 1) != 0) {
+    fprintf(stderr, "Could not listen on %s\n", path);
     return 1;
   }
+  // a client gone away ends its session rather than the server
+  signal(SIGPIPE, SIG_IGN);
+  game->headless = 1;
+  while ((client = accept(server, NULL, NULL)) != -1) {
+    Gym_reset(&reply);
+    open = 1;
+    while (open == 1 && Gym_read(client, &request, sizeof(request)) == 1) {
+      if (request.op == GYM_RESET)
+        Gym_reset(&reply);
+      else if (request.op == GYM_STEP)
+        Gym_step(&reply, request.action, (request.frames == 0) ? 1 : request.frames);
+      else
+        open = 0;
+      if (open == 1)
+        open = Gym_write(client, &reply, sizeof(reply));
+    }
+    close(client);
+  }
+  close(server);
+  unlink(path);
   return 0;
 }
-void Ghost_scare(Ghost *ghost, int s) {
-  if ((ghost->state == 2 && s == 0) || (s == 2 && ghost->state == 1) || (ghost->state == 2 && s == 1) || (s == 1 && ghost->state == 0) || (s == 3 && (ghost->state == 1 || ghost->state == 2)))
-    ghost->state = s;
-  if (s != 2)
-    ghost->image_index = 0;
+void Gym_step(GymReply *reply, int action, int frames) {
+  int score = game->score;
+  while (frames > 0 && game->state != 8) {
+    if (action < 4)
+      game->pacman->nextDir = action;
+    Game_advance();
+    Game_step();
+    --frames;
+  }
+  reply->reward = game->score - score;
+  reply->done = game->state == 8;
+  Observation_take(&reply->observation, game);
 }
-void Ghost_unscare() {
-  clock_t now = clock();
-  double elapsed = ((double) now - game->ticks) / CLOCKS_PER_SEC;
-  int i = 0;
-  while (i < 4) {
-    if (game->ghosts->state == 1 || game->ghosts->state == 2) {
-      if (elapsed >= 0.3)
-        Ghost_scare(game->ghosts, 0);
-      else if (elapsed >= 0.2)
-        Ghost_scare(game->ghosts, 2);
+int Gym_write(int fd, const void *data, size_t size) {
+  ssize_t n;
+  while (size > 0) {
+    if ((n = write(fd, data, size)) <= 0)
+      return 0;
+    data = (const char *) data + n;
+    size -= n;
+  }
+  return 1;
+}
+int Hash_compare(const char *a, const char *b) {
+  HashHeader header[2];
+  HashRecord record[2];
+  FILE *f[2] = { fopen(a, "rb"), fopen(b, "rb") };
+  int i = 0, read[2], differ = 0;
+  Uint32 frames = 0;
+  while (i < 2) {
+    if (f[i] == NULL || fread(&header[i], sizeof(struct HashHeader), 1, f[i]) != 1 || memcmp(header[i].magic, HASH_MAGIC, 8) != 0 || header[i].fields != HASH_FIELDS) {
+      fprintf(stderr, "%s is not a hash stream\n", i == 0 ? a : b);
+      if (f[0] != NULL)
+        fclose(f[0]);
+      if (f[1] != NULL)
+        fclose(f[1]);
+      return 2;
     }
     ++i;
-    game->ghosts = game->ghosts->next;
-  }
-}
-void Image_init() {
-  game->img->life = getImage((char *) "pacman11.gif");
-  game->img->lives = getImage((char *) "lives.png");
-  game->img->gameover = getImage((char *) "gameover.png");
-  game->img->paused = getImage((char *) "paused.png");
-  game->img->getready = getImage((char *) "getready.png");
-  game->img->level = getImage((char *) "level.png");
-  game->img->score = getImage((char *) "score.png");
-  char *str = (char *) malloc(11 * sizeof(char));
+  }
+  while (differ == 0) {
+    read[0] = fread(&record[0], sizeof(struct HashRecord), 1, f[0]);
+    read[1] = fread(&record[1], sizeof(struct HashRecord), 1, f[1]);
+    if (read[0] != 1 || read[1] != 1)
+      break;
+    i = 0;
+    while (i < HASH_FIELDS) {
+      if (record[0].field[i] != record[1].field[i]) {
+        printf("%s %s", (differ == 0) ? "first difference in" : ",", Hash_names[i]);
+        differ = 1;
+      }
+      ++i;
+    }
+    if (record[0].frame != record[1].frame) {
+      printf("%s frame", (differ == 0) ? "first difference in" : ",");
+      differ = 1;
+    }
+    if (differ == 1)
+      printf(" at frame %u\n", record[0].frame);
+    else
+      ++frames;
+  }
+  if (differ == 0 && read[0] != read[1]) {
+    printf("same %u frames, then %s ends\n", frames, (read[0] != 1) ? a : b);
+    differ = 1;
+  }
+  else if (differ == 0)
+    printf("same %u frames\n", frames);
+  fclose(f[0]);
+  fclose(f[1]);
+  return differ;
+}
+void Hash_init() {
+  Uint64 seed = 0x9E3779B97F4A7C15ULL;
+  int Y = 0, X;
+  while (Y < MAZE_HEIGHT) {
+    X = 0;
+    while (X < MAZE_WIDTH) {
+      seed = Hash_mix(seed, Y * MAZE_WIDTH + X);
+      zobrist[Y][X++] = seed;
+    }
+    ++Y;
+  }
+}
+Uint64 Hash_mix(Uint64 h, Uint64 v) {
+  // splitmix64 finaliser over h and v
+  h ^= v + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+  h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+  return h ^ (h >> 31);
+}
+void Hash_pellets() {
+  int Y = 0, X, tile = 0;
+  game->pellets = 0;
+  memset(game->food, 0, sizeof(game->food));
+  game->food_count = 0;
+  while (Y < MAZE_HEIGHT) {
+    X = 0;
+    while (X < MAZE_WIDTH) {
+      if (game->walls[Y][X] == 1) {
+        game->pellets ^= zobrist[Y][X];
+        game->food[tile >> 3] |= 1 << (tile & 7);
+        ++(game->food_count);
+      }
+      ++tile;
+      ++X;
+    }
+    ++Y;
+  }
+}
+void Hash_take(HashRecord *record) {
+  Pacman *pacman = game->pacman;
+  Ghosts *ghosts = game->ghosts;
+  int g = 0;
+  record->frame = game->frame;
+  record->pad = 0;
+  // the pellets are hashed as they go, the few other fields of the frame are mixed in whole
+  record->field[HASH_PELLETS] = game->pellets;
+  record->field[HASH_PACMAN] = Hash_mix(Hash_mix(Hash_mix(0, pacman->x), pacman->y), pacman->dir | pacman->nextDir << 2 | pacman->stuck << 4 | pacman->sub << 5);
+  while (g < 4) {
+    record->field[HASH_GHOSTS + g] = Hash_mix(Hash_mix(Hash_mix(g, ghosts->x[g]), ghosts->y[g]), ghosts->dir[g] | ghosts->state[g] << 2 | ghosts->initloop[g] << 5 | ghosts->sub[g] << 9);
+    ++g;
+  }
+  record->field[HASH_GAME] = Hash_mix(Hash_mix(Hash_mix(Hash_mix(0, game->score), game->lives | game->level << 8 | game->state << 24), game->paused | game->fruit << 1 | game->bonus << 2), (Uint64) (game->frame - game->ticks) << 32 | (game->frame - game->ticks_fruit));
+}
+void Hash_write() {
+  HashRecord record;
+  if (game->hashes == NULL)
+    return;
+  Hash_take(&record);
+  fwrite(&record, sizeof(record), 1, game->hashes);
+}
+int Home::target(int g, int *x, int *y) {
+  *x = game->maze->home[1] * 10;
+  *y = game->maze->home[0] * 10;
+  return 1;
+}
+SDL_Surface *Image_convert(SDL_Surface *image) {
+  // to the screen's format, on the main thread: blits from it are then plain copies
+  SDL_Surface *converted;
+  if (SDL_GetVideoSurface() == NULL)
+    return image;
+  converted = (image->format->Amask != 0) ? SDL_DisplayFormatAlpha(image) : SDL_DisplayFormat(image);
+  if (converted == NULL)
+    return image;
+  SDL_FreeSurface(image);
+  return converted;
+}
+void Image_free() {
+  int b = 0;
+  while (b < BUNDLES) {
+    if (bundles[b].loaded == 1)
+      Bundle_evict(b);
+    ++b;
+  }
+}
+void Image_load(int b) {
+  ImageData *img = game->img;
+  char *str = (char *) malloc(13 * sizeof(char));
   int i = 0;
-  while (i < 4) {
-    snprintf(str, 11, "fruit%d.png", i);
-    game->img->levels[i++] = getImage(str);
+  switch (b) {
+    case BUNDLE_TITLE:
+      img->logo = Asset_get("logo.png");
+      while (i < 39) {
+        snprintf(str, 13, "anim%d.gif", i);
+        img->anim[i++] = Asset_get(str);
+      }
+      img->legal = Asset_get("legal.png");
+      img->notice = Asset_get("notice.png");
+      break;
+    case BUNDLE_MENU:
+      img->logo = Asset_get("logo.png");
+      img->playgame[0] = Asset_get("playgame0.png");
+      img->playgame[1] = Asset_get("playgame1.png");
+      img->highscores[0] = Asset_get("highscores0.png");
+      img->highscores[1] = Asset_get("highscores1.png");
+      img->rules[0] = Asset_get("rules0.png");
+      img->rules[1] = Asset_get("rules1.png");
+      img->quitgame[0] = Asset_get("quitgame0.png");
+      img->quitgame[1] = Asset_get("quitgame1.png");
+      img->rules_main = Asset_get("rules.png");
+      img->back = Asset_get("back.png");
+      break;
+    case BUNDLE_GAME:
+      img->life = Asset_get("pacman11.gif");
+      img->lives = Asset_get("lives.png");
+      img->gameover = Asset_get("gameover.png");
+      img->paused = Asset_get("paused.png");
+      img->getready = Asset_get("getready.png");
+      img->level = Asset_get("level.png");
+      img->score = Asset_get("score.png");
+      while (i < 6) {
+        snprintf(str, 13, "candy%d.gif", i);
+        img->candy[i++] = Asset_get(str);
+      }
+      i = 0;
+      while (i < 4) {
+        snprintf(str, 13, "fruit%d.png", i);
+        img->levels[i++] = Asset_get(str);
+      }
+      i = 0;
+      while (i < 10) {
+        snprintf(str, 13, "%d.png", i);
+        img->digits[i++] = Asset_get(str);
+      }
+      img->bonus100 = Asset_get("100.png");
+      img->bonus200 = Asset_get("200.png");
+      img->bonus300 = Asset_get("300.png");
+      img->bonus400 = Asset_get("400.png");
+      img->bonus500 = Asset_get("500.png");
+      img->bonus700 = Asset_get("700.png");
+      img->bonus800 = Asset_get("800.png");
+      img->bonus1600 = Asset_get("1600.png");
+      Pacman_load();
+      Ghost_load();
+      break;
+    case BUNDLE_SCORES:
+      img->enter = Asset_get("enter.png");
+      img->dot = Asset_get("dot.png");
+      while (i < 10) {
+        snprintf(str, 13, "%d.png", i);
+        img->digits[i++] = Asset_get(str);
+      }
+      i = 0;
+      while (i < 26) {
+        snprintf(str, 13, "letter%d.png", i + 65);
+        img->letters[i++] = Asset_get(str);
+      }
+  }
+  free(str);
+}
+SDL_Surface *Image_read(const char *name) {
+  // decodes only, from the archive or from images/, and says why it could not: safe on a loader thread
+  ArchiveEntry *entry = Archive_find(name);
+  SDL_Surface *image;
+  if (entry != NULL) {
+    if ((image = IMG_Load_RW(SDL_RWFromConstMem(game->archive + entry->offset, entry->size), 1)) == NULL)
+      printf("IMG_Load_RW: %s: %s\n", name, IMG_GetError());
+    return image;
+  }
+  int size = strlen("images/") + strlen(name) + strlen(PACPATH) + 1;
+  char *path = (char *) malloc(size * sizeof(char));
+  snprintf(path, size, "%simages/%s", PACPATH, name);
+  if ((image = IMG_Load(path)) == NULL)
+    printf("IMG_Load: %s\n", IMG_GetError());
+  free(path);
+  return image;
+}
+int Inky::target(int g, int *x, int *y) {
+  *x = game->pacman->x + 20 + abs(game->pacman->x + 20 - game->ghosts->x[BLINKY]);
+  *y = game->pacman->y + 20 + abs(game->pacman->y + 20 - game->ghosts->y[BLINKY]);
+  return 1;
+}
+int Loader_run(void *data) {
+  Loader *loader = (Loader *) data;
+  SDL_Surface *image;
+  int i, n;
+  SDL_LockMutex(loader->lock);
+  while (loader->next < loader->count) {
+    i = loader->next++;
+    SDL_UnlockMutex(loader->lock);
+    // SDL_image keeps the state of its GIF decoder in statics, PNGs decode side by side
+    n = strlen(loader->name[i]);
+    if (n > 4 && strcmp(loader->name[i] + n - 4, ".gif") == 0) {
+      SDL_LockMutex(loader->gif);
+      image = Image_read(loader->name[i]);
+      SDL_UnlockMutex(loader->gif);
+    }
+    else
+      image = Image_read(loader->name[i]);
+    SDL_LockMutex(loader->lock);
+    loader->image[i] = image;
+    loader->done[i] = 1;
+    SDL_CondBroadcast(loader->ready);
+  }
+  SDL_UnlockMutex(loader->lock);
+  return 0;
+}
+void Loader_start(int workers, int b) {
+  Loader *loader = (Loader *) malloc(sizeof(struct Loader));
+  int i = 0;
+  loader->recording = 1;
+  loader->count = 0;
+  loader->next = 0;
+  // a dry run of the loads gives the names and the order they will be asked for
+  game->loader = loader;
+  Image_load(b);
+  loader->recording = 0;
+  loader->workers = (workers > LOADER_MAX_WORKERS) ? LOADER_MAX_WORKERS : (workers < 0) ? 0 : workers;
+  loader->workers = (loader->workers > loader->count) ? loader->count : loader->workers;
+  while (i < loader->count) {
+    loader->image[i] = NULL;
+    loader->done[i] = 0;
+    loader->taken[i++] = 0;
   }
-  char *str2 = (char *) malloc(6 * sizeof(char));
+  loader->lock = SDL_CreateMutex();
+  loader->gif = SDL_CreateMutex();
+  loader->ready = SDL_CreateCond();
   i = 0;
-  while (i < 10) {
-    snprintf(str, 6, "%d.png", i);
-    game->img->digits[i++] = getImage(str);
-  }
-  free(str2);
-  game->img->dot = getImage((char *) "dot.png");
-  game->img->bonus100 = getImage((char *) "100.png");
-  game->img->bonus200 = getImage((char *) "200.png");
-  game->img->bonus300 = getImage((char *) "300.png");
-  game->img->bonus400 = getImage((char *) "400.png");
-  game->img->bonus500 = getImage((char *) "500.png");
-  game->img->bonus700 = getImage((char *) "700.png");
-  game->img->bonus800 = getImage((char *) "800.png");
-  game->img->bonus1600 = getImage((char *) "1600.png");
+  while (i < loader->workers)
+    if ((loader->thread[i] = SDL_CreateThread(Loader_run, loader)) != NULL)
+      ++i;
+    else {
+      fprintf(stderr, "Could not start a loader thread: %s\n", SDL_GetError());
+      loader->workers = i;
+    }
+}
+void Loader_stop() {
+  Loader *loader = game->loader;
+  int i = 0;
+  while (i < loader->workers)
+    SDL_WaitThread(loader->thread[i++], NULL);
   i = 0;
-  while (i < 39) {
-    snprintf(str, 11, "anim%d.gif", i);
-    game->img->anim[i++] = getImage(str);
+  while (i < loader->count) {
+    if (loader->taken[i] == 0 && loader->image[i] != NULL)
+      SDL_FreeSurface(loader->image[i]);
+    ++i;
   }
-  free(str);
-  game->img->logo = getImage((char *) "logo.png");
-  game->img->legal = getImage((char *) "legal.png");
-  game->img->notice = getImage((char *) "notice.png");
-  game->img->playgame[0] = getImage((char *) "playgame0.png");
-  game->img->playgame[1] = getImage((char *) "playgame1.png");
-  game->img->highscores[0] = getImage((char *) "highscores0.png");
-  game->img->highscores[1] = getImage((char *) "highscores1.png");
-  game->img->rules[0] = getImage((char *) "rules0.png");
-  game->img->rules[1] = getImage((char *) "rules1.png");
-  game->img->rules_main = getImage((char *) "rules.png");
-  game->img->quitgame[0] = getImage((char *) "quitgame0.png");
-  game->img->quitgame[1] = getImage((char *) "quitgame1.png");
-  game->img->back = getImage((char *) "back.png");
-  game->img->enter = getImage((char *) "enter.png");
-}
-void Inky_chase(Ghost *ghost) {
-  Ghost *blinky = ghost->next->next;
-  int x = game->pacman->x + 20 + abs(game->pacman->x + 20 - blinky->x);
-  int y = game->pacman->y + 20 + abs(game->pacman->y + 20 - blinky->y);
-  if (ghost->state == 1 || ghost->state == 2) {
-    x = 461 - x;
-    y = 580 - x;
-  }
-  if (x > ghost->x && ghost->ways[RIGHT] == 1 && Ghost_moveRight(ghost) == 1)
-    ghost->dir = RIGHT;
-  else if (y <= ghost->y && ghost->ways[UP] == 1 && Ghost_moveUp(ghost) == 1)
-    ghost->dir = UP;
-  else if (y > ghost->y && ghost->ways[DOWN] == 1 && Ghost_moveDown(ghost) == 1)
-    ghost->dir = DOWN;
-  else if (ghost->dir == LEFT && Ghost_moveLeft(ghost) == 0) {
-    if (y >= ghost->y && ghost->ways[DOWN] == 1 && Ghost_moveDown(ghost) == 1)
-      ghost->dir = DOWN;
-    else if (ghost->ways[UP] == 1 && Ghost_moveUp(ghost) == 1)
-      ghost->dir = UP;
-    else {
-      ghost->dir = DOWN;
-      Ghost_moveDown(ghost);
+  SDL_DestroyCond(loader->ready);
+  SDL_DestroyMutex(loader->gif);
+  SDL_DestroyMutex(loader->lock);
+  free(loader);
+  game->loader = NULL;
+}
+SDL_Surface *Loader_take(const char *name) {
+  Loader *loader = game->loader;
+  SDL_Surface *image;
+  int i = 0;
+  while (i < loader->count && strcmp(loader->name[i], name) != 0)
+    ++i;
+  // without a thread to decode them, the images are decoded as they are asked for
+  if (i == loader->count || loader->workers == 0)
+    return getImage((char *) name);
+  SDL_LockMutex(loader->lock);
+  while (loader->done[i] == 0)
+    SDL_CondWait(loader->ready, loader->lock);
+  image = loader->image[i];
+  loader->taken[i] = 1;
+  SDL_UnlockMutex(loader->lock);
+  // a thread only hands back the decoded pixels, or NULL when it failed: both are settled here
+  if (image == NULL) {
+    Loader_stop();
+    exit(cleanUp(1));
+  }
+  return Image_convert(image);
+}
+void Maze_draw() {
+  // tile edges facing an open tile
+  int Y = 0, X, x, y;
+  while (Y < MAZE_HEIGHT) {
+    X = 0;
+    while (X < MAZE_WIDTH) {
+      x = X * 10;
+      y = Y * 10;
+      if (game->maze->walls[Y][X] != -1)
+        ;
+      else {
+        if (Y > 0 && game->maze->walls[Y - 1][X] != -1)
+          lineRGBA(game->screen, x, y, x + 9, y, MAZE_R, MAZE_G, MAZE_B, 255);
+        if (Y < MAZE_HEIGHT - 1 && game->maze->walls[Y + 1][X] != -1)
+          lineRGBA(game->screen, x, y + 9, x + 9, y + 9, MAZE_R, MAZE_G, MAZE_B, 255);
+        if (X > 0 && game->maze->walls[Y][X - 1] != -1)
+          lineRGBA(game->screen, x, y, x, y + 9, MAZE_R, MAZE_G, MAZE_B, 255);
+        if (X < MAZE_WIDTH - 1 && game->maze->walls[Y][X + 1] != -1)
+          lineRGBA(game->screen, x + 9, y, x + 9, y + 9, MAZE_R, MAZE_G, MAZE_B, 255);
+      }
+      ++X;
     }
+    ++Y;
   }
-  else if (ghost->dir == DOWN && Ghost_moveDown(ghost) == 0) {
-    if (x >= ghost->x && ghost->ways[RIGHT] == 1 && Ghost_moveRight(ghost) == 1)
-      ghost->dir = RIGHT;
-    else if (ghost->ways[LEFT] == 1 && Ghost_moveLeft(ghost) == 1)
-      ghost->dir = LEFT;
-    else {
-      ghost->dir = RIGHT;
-      Ghost_moveRight(ghost);
+}
+void Maze_free() {
+  if (game->blob == NULL)
+    free(game->mazes);
+#ifndef EMBED_IMAGES
+  else
+    munmap(game->blob, game->blob_size);
+#endif
+}
+int Maze_init(const char *dir) {
+  int size = strlen(dir) + strlen("maze.txt") + 12, i = 0;
+  char *path = (char *) malloc(size * sizeof(char));
+  FILE *f;
+  game->mazes = NULL;
+  game->maze = NULL;
+  game->maze_count = 0;
+  snprintf(path, size, "%smaze%d.txt", dir, i);
+  while ((f = fopen(path, "r")) != NULL) {
+    game->mazes = (Maze *) realloc(game->mazes, (game->maze_count + 1) * sizeof(struct Maze));
+    if (Maze_load(&game->mazes[game->maze_count], f))
+      ++(game->maze_count);
+    else
+      printf("Cannot read maze %s\n", path);
+    fclose(f);
+    snprintf(path, size, "%smaze%d.txt", dir, ++i);
+  }
+  free(path);
+  return game->maze_count;
+}
+int Maze_load(Maze *maze, FILE *f) {
+  char line[512], *p;
+  int Y = 0, X, n, grid = -1, a, b, c, d;
+  while (Y < MAZE_HEIGHT) {
+    X = 0;
+    while (X < MAZE_WIDTH) {
+      maze->walls[Y][X] = -1;
+      maze->power[Y][X] = 0;
+      maze->column[X++] = -1;
     }
+    maze->row[Y] = -1;
+    maze->tunnel[Y++] = 0;
   }
-  else if (ghost->dir == RIGHT && Ghost_moveRight(ghost) == 0) {
-    if (y >= ghost->y && ghost->ways[DOWN] == 1 && Ghost_moveDown(ghost) == 1)
-      ghost->dir = DOWN;
-    else if (ghost->ways[UP] == 1 && Ghost_moveUp(ghost) == 1)
-      ghost->dir = UP;
-    else {
-      ghost->dir = DOWN;
-      Ghost_moveDown(ghost);
+  maze->powers = 0;
+  maze->doors = 0;
+  maze->home[0] = -1;
+  maze->start[0] = -1;
+  maze->wrap[0] = maze->wrap[1] = maze->wrap[2] = -1;
+  maze->slow[0] = -1;
+  maze->slow[1] = MAZE_WIDTH * 10;
+  maze->outline = 0;
+  while (grid < MAZE_HEIGHT && fgets(line, sizeof(line), f) != NULL) {
+    if (grid >= 0) {
+      // a row may lose its trailing spaces, the rest of it is empty
+      X = 0;
+      n = strlen(line);
+      while (X < MAZE_WIDTH) {
+        maze->walls[grid][X] = (X >= n || line[X] == ' ' || line[X] == '\n') ? 0 : (line[X] == '.') ? 1 : -1;
+        ++X;
+      }
+      ++grid;
+    }
+    else if (line[0] == '#')
+      ;
+    else if (strncmp(line, "outline classic", 15) == 0)
+      maze->outline = 1;
+    else if (strncmp(line, "columns ", 8) == 0 || strncmp(line, "rows ", 5) == 0) {
+      int *table = (line[0] == 'c') ? maze->column : maze->row, size = (line[0] == 'c') ? MAZE_WIDTH : MAZE_HEIGHT;
+      p = strchr(line, ' ');
+      X = 0;
+      while (X < size && sscanf(p, "%d%n", &table[X], &n) == 1) {
+        p += n;
+        ++X;
+      }
+    }
+    else if (sscanf(line, "power %d %d %d %d", &a, &b, &c, &d) == 4 && maze->powers < MAZE_MAX_POWERS && a >= 0 && a < MAZE_HEIGHT && b >= 0 && b < MAZE_WIDTH) {
+      maze->power[a][b] = 1;
+      maze->sprite[maze->powers][0] = a;
+      maze->sprite[maze->powers][1] = b;
+      maze->sprite[maze->powers][2] = c;
+      maze->sprite[maze->powers++][3] = d;
     }
+    else if (sscanf(line, "tunnel %d", &a) == 1 && a >= 0 && a < MAZE_HEIGHT)
+      maze->tunnel[a] = 1;
+    else if (sscanf(line, "door %d %d", &a, &b) == 2 && maze->doors < MAZE_MAX_DOORS) {
+      maze->door[maze->doors][0] = a;
+      maze->door[maze->doors++][1] = b;
+    }
+    else if (sscanf(line, "home %d %d", &a, &b) == 2) {
+      maze->home[0] = a;
+      maze->home[1] = b;
+    }
+    else if (sscanf(line, "wrap %d %d %d", &a, &b, &c) == 3) {
+      maze->wrap[0] = a;
+      maze->wrap[1] = b;
+      maze->wrap[2] = c;
+    }
+    else if (sscanf(line, "slow %d %d", &a, &b) == 2) {
+      maze->slow[0] = a;
+      maze->slow[1] = b;
+    }
+    else if (sscanf(line, "start %d %d", &a, &b) == 2 && a >= 0 && a < MAZE_HEIGHT && b >= 0 && b < MAZE_WIDTH) {
+      maze->start[0] = a;
+      maze->start[1] = b;
+    }
+    else if (strncmp(line, "grid", 4) == 0)
+      grid = 0;
   }
-  else if (ghost->dir == UP && Ghost_moveUp(ghost) == 0) {
-    if (x >= ghost->x && ghost->ways[RIGHT] == 1 && Ghost_moveRight(ghost) == 1)
-      ghost->dir = RIGHT;
-    else if (ghost->ways[LEFT] == 1 && Ghost_moveLeft(ghost) == 1)
-      ghost->dir = LEFT;
-    else {
-      ghost->dir = RIGHT;
-      Ghost_moveRight(ghost);
+  return grid == MAZE_HEIGHT && maze->doors > 0 && maze->home[0] >= 0 && maze->start[0] >= 0 && maze->walls[maze->start[0]][maze->start[1]] != -1;
+}
+int Maze_power(int Y, int X, int vertical) {
+  // one of the three tiles Pac-Man is clearing holds a power pellet still
+  int i = 0;
+  while (i < 3) {
+    if (Y >= 0 && Y < MAZE_HEIGHT && X >= 0 && X < MAZE_WIDTH && game->maze->power[Y][X] == 1 && game->walls[Y][X] == 1)
+      return 1;
+    if (vertical)
+      ++Y;
+    else
+      ++X;
+    ++i;
+  }
+  return 0;
+}
+void Maze_select() {
+  int i = (game->level + game->maze_count - 1) % game->maze_count;
+  game->maze = &game->mazes[i];
+  game->chase_tile = -1;
+  if (game->navs != NULL) {
+    game->nav = &game->navs[i];
+    Blob_background(i);
+  }
+  else if (game->nav->maze != i)
+    Nav_build();
+}
+int Maze_tunnel(int y) {
+  return y % 10 == 0 && y >= 0 && y < MAZE_HEIGHT * 10 && game->maze->tunnel[y / 10];
+}
+void Nav_build() {
+  Nav *nav = game->nav;
+  Uint8 exits;
+  int Y = 0, X, dir, i;
+  while (Y < MAZE_HEIGHT) {
+    X = 0;
+    while (X < MAZE_WIDTH) {
+      exits = 0;
+      if (Nav_clear(Y, X + 3, 1))
+        exits |= 1 << RIGHT;
+      if (Nav_clear(Y, X - 1, 1))
+        exits |= 1 << LEFT;
+      if (Nav_clear(Y - 1, X, 0))
+        exits |= 1 << UP;
+      if (Nav_clear(Y + 3, X, 0))
+        exits |= 1 << DOWN;
+      if (Nav_clear(Y, X, 1))
+        exits |= NAV_LEFT_IN;
+      if (Nav_clear(Y, X, 0))
+        exits |= NAV_UP_IN;
+      nav->exits[NAV_PACMAN][Y][X] = exits;
+      // ghosts leave the house through the door
+      i = 0;
+      while (i < game->maze->doors) {
+        if (X == game->maze->door[i][1] && Y == game->maze->door[i][0])
+          exits |= 1 << UP;
+        if (X == game->maze->door[i][1] && Y == game->maze->door[i][0] - 1)
+          exits |= NAV_UP_IN;
+        ++i;
+      }
+      nav->exits[NAV_GHOST][Y][X] = exits;
+      // eyes enter it again
+      if (X == game->maze->home[1] && Y == game->maze->home[0])
+        exits |= 1 << DOWN;
+      nav->exits[NAV_EYES][Y][X] = exits;
+      nav->node_index[Y][X] = -1;
+      nav->tile_index[Y][X] = -1;
+      nav->nearest[Y][X] = -1;
+      ++X;
+    }
+    ++Y;
+  }
+  // junctions are the reachable tiles offering more than two ways, starting from the maze's start tile
+  int queue[MAZE_HEIGHT * MAZE_WIDTH], head = 0, tail = 0;
+  nav->nodes = 0;
+  nav->tile_index[game->maze->start[0]][game->maze->start[1]] = tail;
+  queue[tail++] = game->maze->start[0] * MAZE_WIDTH + game->maze->start[1];
+  while (head < tail) {
+    Y = queue[head] / MAZE_WIDTH;
+    X = queue[head++] % MAZE_WIDTH;
+    exits = nav->exits[NAV_GHOST][Y][X];
+    if (nav->nodes < NAV_MAX_NODES && ((exits >> RIGHT) & 1) + ((exits >> LEFT) & 1) + ((exits >> UP) & 1) + ((exits >> DOWN) & 1) > 2) {
+      nav->node[nav->nodes][0] = Y;
+      nav->node[nav->nodes][1] = X;
+      nav->node_index[Y][X] = nav->nodes++;
+    }
+    dir = 0;
+    while (dir < 4) {
+      int y = Y, x = X;
+      Nav_step(game->maze, &y, &x, dir);
+      if ((exits & (1 << dir)) && nav->tile_index[y][x] == -1) {
+        nav->tile_index[y][x] = tail;
+        queue[tail++] = y * MAZE_WIDTH + x;
+      }
+      ++dir;
+    }
+  }
+  Nav_paths(queue, tail);
+  // spread the tile numbers over the whole grid, ignoring walls
+  head = 0;
+  while (head < tail) {
+    Y = queue[head] / MAZE_WIDTH;
+    X = queue[head++] % MAZE_WIDTH;
+    nav->nearest[Y][X] = nav->tile_index[Y][X];
+  }
+  head = 0;
+  while (head < tail) {
+    Y = queue[head] / MAZE_WIDTH;
+    X = queue[head++] % MAZE_WIDTH;
+    dir = 0;
+    while (dir < 4) {
+      int y = Y + ((dir == DOWN) ? 1 : (dir == UP) ? -1 : 0), x = X + ((dir == RIGHT) ? 1 : (dir == LEFT) ? -1 : 0);
+      if (y >= 0 && y < MAZE_HEIGHT && x >= 0 && x < MAZE_WIDTH && nav->nearest[y][x] == -1) {
+        nav->nearest[y][x] = nav->nearest[Y][X];
+        queue[tail++] = y * MAZE_WIDTH + x;
+      }
+      ++dir;
+    }
+  }
+  i = 0;
+  while (i < nav->nodes) {
+    dir = 0;
+    while (dir < 4) {
+      int *segment = nav->segment[i][dir], d = dir;
+      segment[0] = -1;
+      segment[1] = 0;
+      Y = nav->node[i][0];
+      X = nav->node[i][1];
+      while (nav->exits[NAV_GHOST][Y][X] & (1 << d) && segment[1] < MAZE_HEIGHT * MAZE_WIDTH) {
+        Nav_step(game->maze, &Y, &X, d);
+        ++segment[1];
+        if (nav->node_index[Y][X] != -1) {
+          segment[0] = nav->node_index[Y][X];
+          break;
+        }
+        exits = nav->exits[NAV_GHOST][Y][X] & 15 & ~(1 << Nav_reverse(d));
+        if (exits == 0 || (exits & (exits - 1)) != 0)
+          break;
+        d = Nav_dir(exits);
+      }
+      ++dir;
     }
+    ++i;
   }
+  Nav_field(nav->home, NAV_EYES, game->maze->home[0], game->maze->home[1]);
+  nav->maze = game->maze - game->mazes;
 }
-void Pacman_checkDir() {
-  int YY = (int) game->pacman->y / 10;
-  int XX = (int) game->pacman->x / 10;
-  if (game->pacman->y % 10 == 0) {
-    int Y = YY;
-    int X = XX + 3;
-    if (game->pacman->nextDir == RIGHT && game->walls[Y++][X] != -1 && game->walls[Y++][X] != -1 && game->walls[Y][X] != -1)
-      game->pacman->dir = RIGHT;
-    Y = YY;
-    X = XX - 1;
-    if (game->pacman->nextDir == LEFT && game->walls[Y++][X] != -1 && game->walls[Y++][X] != -1 && game->walls[Y][X] != -1)
-      game->pacman->dir = LEFT;
-  }
-  if (game->pacman->x % 10 == 0) {
-    int Y = YY - 1;
-    int X = XX;
-    if (game->pacman->nextDir == UP && game->walls[Y][X++] != -1 && game->walls[Y][X++] != -1 && game->walls[Y][X] != -1)
-      game->pacman->dir = UP;
-    X = XX;
-    Y = YY + 3;
-    if (game->pacman->nextDir == DOWN && game->walls[Y][X++] != -1 && game->walls[Y][X++] != -1 && game->walls[Y][X] != -1)
-      game->pacman->dir = DOWN;
+int Nav_canMove(int kind, int x, int y, int dir) {
+  Uint8 exits = game->nav->exits[kind][y / 10][x / 10];
+  if (dir == LEFT && x % 10 != 0)
+    return (exits & NAV_LEFT_IN) != 0;
+  if (dir == UP && y % 10 != 0)
+    return (exits & NAV_UP_IN) != 0;
+  return (exits & (1 << dir)) != 0;
+}
+int Nav_cell(const GameData *view, int tile) {
+  // the grid cell, Y * MAZE_WIDTH + X, of a place in the tile list
+  if (tile < 0 || tile >= view->nav->tiles)
+    return -1;
+  return ((const int *) (view->tables + view->nav->tile))[tile];
+}
+void Nav_chase() {
+  int tile = game->pacman->y / 10 * MAZE_WIDTH + game->pacman->x / 10;
+  if (tile != game->chase_tile) {
+    Nav_field(game->chase, NAV_GHOST, tile / MAZE_WIDTH, tile % MAZE_WIDTH);
+    game->chase_tile = tile;
+  }
+}
+int Nav_clear(int Y, int X, int vertical) {
+  int i = 0;
+  while (i < 3) {
+    if (Y < 0 || Y >= MAZE_HEIGHT || X < 0 || X >= MAZE_WIDTH || game->walls[Y][X] == -1)
+      return 0;
+    if (vertical)
+      ++Y;
+    else
+      ++X;
+    ++i;
+  }
+  return 1;
+}
+int Nav_dir(int exits) {
+  return (exits == 1 << RIGHT) ? RIGHT : (exits == 1 << LEFT) ? LEFT : (exits == 1 << UP) ? UP : DOWN;
+}
+int Nav_distance(const GameData *view, int Y1, int X1, int Y2, int X2) {
+  int a = view->nav->tile_index[Y1][X1], b = view->nav->tile_index[Y2][X2];
+  Uint8 *distance = view->tables + view->nav->distance;
+  if (a == -1 || b == -1 || distance[a * view->nav->tiles + b] == NAV_NEAR_FAR)
+    return NAV_FAR;
+  return distance[a * view->nav->tiles + b];
+}
+void Nav_field(Uint16 field[MAZE_HEIGHT][MAZE_WIDTH], int kind, int Y, int X) {
+  // breadth-first search backwards from the target along the exits of the given kind
+  int queue[MAZE_HEIGHT * MAZE_WIDTH], head = 0, tail = 0, dir, y, x;
+  memset(field, 0xFF, MAZE_HEIGHT * MAZE_WIDTH * sizeof(Uint16));
+  field[Y][X] = 0;
+  queue[tail++] = Y * MAZE_WIDTH + X;
+  while (head < tail) {
+    Y = queue[head] / MAZE_WIDTH;
+    X = queue[head++] % MAZE_WIDTH;
+    dir = 0;
+    while (dir < 4) {
+      y = Y;
+      x = X;
+      Nav_step(game->maze, &y, &x, Nav_reverse(dir));
+      if (y >= 0 && y < MAZE_HEIGHT && x >= 0 && x < MAZE_WIDTH && field[y][x] == NAV_FAR && (game->nav->exits[kind][y][x] & (1 << dir))) {
+        field[y][x] = field[Y][X] + 1;
+        queue[tail++] = y * MAZE_WIDTH + x;
+      }
+      ++dir;
+    }
+  }
+}
+void Nav_free() {
+  if (game->tables != (Uint8 *) game->blob)
+    free(game->tables);
+  game->tables = NULL;
+}
+int Nav_hop(const GameData *view, int Y1, int X1, int Y2, int X2) {
+  int a = view->nav->tile_index[Y1][X1], b = view->nav->tile_index[Y2][X2];
+  if (a == -1 || b == -1 || a == b || view->tables[view->nav->distance + a * view->nav->tiles + b] == NAV_NEAR_FAR)
+    return -1;
+  return view->tables[view->nav->hop + a * view->nav->tiles + b];
+}
+int Nav_kind(int g) {
+  return (game->ghosts->state[g] == 3) ? NAV_EYES : NAV_GHOST;
+}
+int Nav_nearest(const GameData *view, int x, int y) {
+  int Y = (y < 0) ? 0 : (y / 10 >= MAZE_HEIGHT) ? MAZE_HEIGHT - 1 : y / 10;
+  int X = (x < 0) ? 0 : (x / 10 >= MAZE_WIDTH) ? MAZE_WIDTH - 1 : x / 10;
+  return view->nav->nearest[Y][X];
+}
+void Nav_paths(int *tile, int tiles) {
+  Nav *nav = game->nav;
+  int *queue = (int *) malloc(tiles * sizeof(int)), a = 0, head, tail, b, dir, Y, X;
+  Uint8 exits;
+  Nav_free();
+  // the tile list, then the distance and hop tables, in one block
+  nav->tiles = tiles;
+  nav->tile = 0;
+  nav->distance = tiles * sizeof(int);
+  nav->hop = nav->distance + tiles * tiles;
+  game->tables = (Uint8 *) malloc(nav->hop + tiles * tiles);
+  memcpy(game->tables + nav->tile, tile, tiles * sizeof(int));
+  memset(game->tables + nav->distance, NAV_NEAR_FAR, tiles * tiles * sizeof(Uint8));
+  // one breadth-first search per tile, each tile inheriting the first move of its parent; along the
+  // exits the tiles were numbered by, which are those of the ghosts every caller measures for
+  while (a < tiles) {
+    Uint8 *distance = game->tables + nav->distance + a * tiles, *hop = game->tables + nav->hop + a * tiles;
+    head = 0;
+    tail = 0;
+    distance[a] = 0;
+    queue[tail++] = a;
+    while (head < tail) {
+      b = queue[head++];
+      exits = nav->exits[NAV_GHOST][tile[b] / MAZE_WIDTH][tile[b] % MAZE_WIDTH];
+      dir = 0;
+      while (dir < 4) {
+        Y = tile[b] / MAZE_WIDTH;
+        X = tile[b] % MAZE_WIDTH;
+        Nav_step(game->maze, &Y, &X, dir);
+        if ((exits & (1 << dir)) && nav->tile_index[Y][X] != -1
+            && distance[nav->tile_index[Y][X]] == NAV_NEAR_FAR && distance[b] + 1 < NAV_NEAR_FAR) {
+          distance[nav->tile_index[Y][X]] = distance[b] + 1;
+          hop[nav->tile_index[Y][X]] = (b == a) ? dir : hop[b];
+          queue[tail++] = nav->tile_index[Y][X];
+        }
+        ++dir;
+      }
+    }
+    ++a;
+  }
+  free(queue);
+}
+int Nav_reverse(int dir) {
+  return dir ^ 1;
+}
+void Nav_step(const Maze *maze, int *Y, int *X, int dir) {
+  // the tiles of the maze's wrap columns, on its tunnel rows only
+  int tunnel = maze->wrap[0] >= 0 && maze->tunnel[*Y];
+  switch (dir) {
+    case RIGHT:
+      *X = (tunnel && *X == maze->wrap[1] / 10) ? maze->wrap[0] / 10 : *X + 1;
+      break;
+    case LEFT:
+      *X = (tunnel && *X == maze->wrap[0] / 10) ? maze->wrap[2] / 10 : *X - 1;
+      break;
+    case UP:
+      --(*Y);
+      break;
+    case DOWN:
+      ++(*Y);
   }
 }
+int Nav_ways(int kind, int x, int y) {
+  int mask = ((y % 10 == 0) ? (1 << RIGHT | 1 << LEFT) : 0) | ((x % 10 == 0) ? (1 << UP | 1 << DOWN) : 0);
+  return game->nav->exits[kind][y / 10][x / 10] & mask;
+}
+void Observation_take(Observation *observation, const GameData *view) {
+  int g = 0;
+  observation->frame = view->frame;
+  observation->score = view->score;
+  observation->lives = view->lives;
+  observation->level = view->level;
+  observation->state = view->state;
+  observation->pellets = view->food_count;
+  observation->pacman[0] = view->pacman->x;
+  observation->pacman[1] = view->pacman->y;
+  observation->pacman[2] = view->pacman->dir;
+  while (g < 4) {
+    observation->ghosts[g][0] = view->ghosts->x[g];
+    observation->ghosts[g][1] = view->ghosts->y[g];
+    observation->ghosts[g][2] = view->ghosts->dir[g];
+    observation->ghosts[g][3] = view->ghosts->state[g];
+    ++g;
+  }
+  memcpy(observation->food, view->food, sizeof(observation->food));
+}
+void Pacman_checkDir() {
+  if (Nav_ways(NAV_PACMAN, game->pacman->x, game->pacman->y) & (1 << game->pacman->nextDir))
+    game->pacman->dir = game->pacman->nextDir;
+}
 void Pacman_draw() {
   int x = (game->pacman->stuck == 1 || game->pacman->dir == DOWN || game->pacman->dir == UP) ? game->pacman->x + 1 : game->pacman->x;
   int y = (game->pacman->stuck == 1 || game->pacman->dir == RIGHT || game->pacman->dir == LEFT) ? game->pacman->y + 1 : game->pacman->y;
@@ -2001,13 +3947,22 @@ void Pacman_draw() {
   if (game->pacman->image_index == 4)
   	game->pacman->image_index = 0;
 }
+void Pacman_eat(int Y, int X) {
+  int tile = Y * MAZE_WIDTH + X;
+  if (game->walls[Y][X] == 1) {
+    game->pellets ^= zobrist[Y][X];
+    game->food[tile >> 3] &= ~(1 << (tile & 7));
+    --(game->food_count);
+  }
+  game->walls[Y][X] = 0;
+}
 void Pacman_init() {
   game->pacman->x = 217;
   game->pacman->y = 390;
-  Pacman_load();
   game->pacman->image_index = 1;
   game->pacman->dir = LEFT;
   game->pacman->nextDir = LEFT;
+  game->pacman->sub = 0;
 }
 void Pacman_load() {
   char *str = (char *) malloc(13 * sizeof(char));
@@ -2016,7 +3971,7 @@ void Pacman_load() {
     j = 0;
     while (j < 4) {
       snprintf(str, 13, "pacman%d%d.gif", i, j);
-      game->pacman->image[i][j++] = getImage(str);
+      game->pacman->image[i][j++] = Asset_get(str);
     }
     ++i;
   }
@@ -2025,7 +3980,7 @@ void Pacman_load() {
   i = 0;
   while (i < 12) {
     snprintf(str, 11, "dead%d.gif", i);
-    game->pacman->dead[i++] = getImage(str);
+    game->pacman->dead[i++] = Asset_get(str);
   }
   free(str);
 }
@@ -2033,26 +3988,26 @@ void Pacman_move() {
   Pacman_checkDir();
   game->pacman->stuck = 0;
   if (game->pacman->dir == RIGHT) {
-    if (game->pacman->x == 429 && game->pacman->y == 230)
-      game->pacman->x = 10;
+    if (game->pacman->x == game->maze->wrap[1] && Maze_tunnel(game->pacman->y))
+      game->pacman->x = game->maze->wrap[0];
     else {
-      int Y = (int) game->pacman->y / 10;
+      int Y = (int) game->pacman->y / 10 + 2;
       int X = (int) game->pacman->x / 10 + 3;
-      if (game->walls[Y++][X] != -1 && game->walls[Y++][X] != -1 && game->walls[Y][X] != -1) {
+      if (Nav_canMove(NAV_PACMAN, game->pacman->x, game->pacman->y, RIGHT)) {
         game->pacman->x += 1;
 	if (game->walls[Y--][X] == 1 || game->walls[Y--][X] == 1 || game->walls[Y][X] == 1) {
 	  Y += 2;
-	  if (Y == 41 && X == 43) {
+	  if (Maze_power(Y - 2, X, 1)) {
 	    game->score += 40;
-	    game->ticks = clock();
-	    Ghost_scare(game->ghosts, 1);
-	    Ghost_scare(game->ghosts->next, 1);
-	    Ghost_scare(game->ghosts->next->next, 1);
-	    Ghost_scare(game->ghosts->next->next->next, 1);
+	    game->ticks = game->frame;
+	    Ghost_scare(BLINKY, 1);
+	    Ghost_scare(PINKY, 1);
+	    Ghost_scare(INKY, 1);
+	    Ghost_scare(CLYDE, 1);
 	  }
-	  game->walls[Y--][X] = 0;
-	  game->walls[Y--][X] = 0;
-	  game->walls[Y][X] = 0;
+	  Pacman_eat(Y--, X);
+	  Pacman_eat(Y--, X);
+	  Pacman_eat(Y, X);
 	  game->score += 10;
 	}
       }
@@ -2061,26 +4016,26 @@ void Pacman_move() {
     }
   }
   else if (game->pacman->dir == LEFT) {
-    if (game->pacman->x == 10 && game->pacman->y == 230)
-      game->pacman->x = 425;
+    if (game->pacman->x == game->maze->wrap[0] && Maze_tunnel(game->pacman->y))
+      game->pacman->x = game->maze->wrap[2];
     else {
-      int Y = (int) game->pacman->y / 10;
+      int Y = (int) game->pacman->y / 10 + 2;
       int X = (int) (game->pacman->x - 1) / 10;
-      if (game->walls[Y++][X] != -1 && game->walls[Y++][X] != -1 && game->walls[Y][X] != -1) {
+      if (Nav_canMove(NAV_PACMAN, game->pacman->x, game->pacman->y, LEFT)) {
         game->pacman->x -= 1;
 	if (game->walls[Y--][X] == 1 || game->walls[Y--][X] == 1 || game->walls[Y][X] == 1) {
 	  Y += 2;
-	  if (Y == 41 && X == 2) {
+	  if (Maze_power(Y - 2, X, 1)) {
 	    game->score += 40;
-	    game->ticks = clock();
-	    Ghost_scare(game->ghosts, 1);
-	    Ghost_scare(game->ghosts->next, 1);
-	    Ghost_scare(game->ghosts->next->next, 1);
-	    Ghost_scare(game->ghosts->next->next->next, 1);
+	    game->ticks = game->frame;
+	    Ghost_scare(BLINKY, 1);
+	    Ghost_scare(PINKY, 1);
+	    Ghost_scare(INKY, 1);
+	    Ghost_scare(CLYDE, 1);
 	  }
-	  game->walls[Y--][X] = 0;
-	  game->walls[Y--][X] = 0;
-	  game->walls[Y][X] = 0;
+	  Pacman_eat(Y--, X);
+	  Pacman_eat(Y--, X);
+	  Pacman_eat(Y, X);
 	  game->score += 10;
 	}
       }
@@ -2090,22 +4045,22 @@ void Pacman_move() {
   }
   else if (game->pacman->dir == UP) {
     int Y = (int) (game->pacman->y - 1) / 10;
-    int X = (int) game->pacman->x / 10;
-    if (game->walls[Y][X++] != -1 && game->walls[Y][X++] != -1 && game->walls[Y][X] != -1) {
+    int X = (int) game->pacman->x / 10 + 2;
+    if (Nav_canMove(NAV_PACMAN, game->pacman->x, game->pacman->y, UP)) {
       game->pacman->y -= 1;
       if (game->walls[Y][X--] == 1 || game->walls[Y][X--] == 1 || game->walls[Y][X] == 1) {
         X += 2;
-	if (Y == 4 && (X == 3 || X == 44)) {
+	if (Maze_power(Y, X - 2, 0)) {
 	  game->score += 40;
-	  game->ticks = clock();
-	  Ghost_scare(game->ghosts, 1);
-	  Ghost_scare(game->ghosts->next, 1);
-	  Ghost_scare(game->ghosts->next->next, 1);
-	  Ghost_scare(game->ghosts->next->next->next, 1);
+	  game->ticks = game->frame;
+	  Ghost_scare(BLINKY, 1);
+	  Ghost_scare(PINKY, 1);
+	  Ghost_scare(INKY, 1);
+	  Ghost_scare(CLYDE, 1);
 	}
-	game->walls[Y][X--] = 0;
-	game->walls[Y][X--] = 0;
-	game->walls[Y][X] = 0;
+	Pacman_eat(Y, X--);
+	Pacman_eat(Y, X--);
+	Pacman_eat(Y, X);
 	game->score += 10;
       }
     }
@@ -2114,22 +4069,22 @@ void Pacman_move() {
   }
   else {
     int Y = (int) game->pacman->y / 10 + 3;
-    int X = (int) game->pacman->x / 10;
-    if (game->walls[Y][X++] != -1 && game->walls[Y][X++] != -1 && game->walls[Y][X] != -1) {
+    int X = (int) game->pacman->x / 10 + 2;
+    if (Nav_canMove(NAV_PACMAN, game->pacman->x, game->pacman->y, DOWN)) {
       game->pacman->y += 1;
       if (game->walls[Y][X--] == 1 || game->walls[Y][X--] == 1 || game->walls[Y][X] == 1) {
         X += 2;
-	if ((Y == 4 || Y == 40) && (X == 3 || X == 44)) {
+	if (Maze_power(Y, X - 2, 0)) {
 	  game->score += 40;
-	  game->ticks = clock();
-	  Ghost_scare(game->ghosts, 1);
-	  Ghost_scare(game->ghosts->next, 1);
-	  Ghost_scare(game->ghosts->next->next, 1);
-	  Ghost_scare(game->ghosts->next->next->next, 1);
+	  game->ticks = game->frame;
+	  Ghost_scare(BLINKY, 1);
+	  Ghost_scare(PINKY, 1);
+	  Ghost_scare(INKY, 1);
+	  Ghost_scare(CLYDE, 1);
 	}
-	game->walls[Y][X--] = 0;
-	game->walls[Y][X--] = 0;
-	game->walls[Y][X] = 0;
+	Pacman_eat(Y, X--);
+	Pacman_eat(Y, X--);
+	Pacman_eat(Y, X);
 	game->score += 10;
       }
     }
@@ -2137,688 +4092,855 @@ void Pacman_move() {
       game->pacman->stuck = 1;
   }
 }
-void Pinky_chase(Ghost *ghost) {
-  int x = game->pacman->x;
-  int y = game->pacman->y;
-  if (ghost->state == 1 || ghost->state == 2) {
-    x = 461 - x;
-    y = 580 - y;
-  }
-  if (y < ghost->y && ghost->ways[UP] == 1 && Ghost_moveUp(ghost) == 1)
-    ghost->dir = UP;
-  else if (x >= ghost->x && ghost->ways[RIGHT] == 1 && Ghost_moveRight(ghost) == 1)
-    ghost->dir = RIGHT;
-  else if (y >= ghost->y && ghost->ways[DOWN] == 1 && Ghost_moveDown(ghost) == 1)
-    ghost->dir = DOWN;
-  else if (x < ghost->x && ghost->ways[LEFT] == 1 && Ghost_moveLeft(ghost) == 1)
-    ghost->dir = LEFT;
-  else if (ghost->dir == LEFT && Ghost_moveLeft(ghost) == 0) {
-    if (y >= ghost->y && ghost->ways[DOWN] == 1 && Ghost_moveDown(ghost) == 1)
-      ghost->dir = DOWN;
-    else if (ghost->ways[UP] == 1 && Ghost_moveUp(ghost) == 1)
-      ghost->dir = UP;
-    else {
-      ghost->dir = DOWN;
-      Ghost_moveDown(ghost);
+int Pinky::target(int g, int *x, int *y) {
+  // lies in wait PINKY_AHEAD pixels where Pac-Man is heading rather than running after him
+  *x = game->pacman->x + ((game->pacman->dir == RIGHT) ? PINKY_AHEAD : (game->pacman->dir == LEFT) ? -PINKY_AHEAD : 0);
+  *y = game->pacman->y + ((game->pacman->dir == DOWN) ? PINKY_AHEAD : (game->pacman->dir == UP) ? -PINKY_AHEAD : 0);
+  return 1;
+}
+void raiseWalls() {
+  // the walls first, a Nav that Maze_select builds goes by them
+  memcpy(game->walls, game->mazes[(game->level + game->maze_count - 1) % game->maze_count].walls, sizeof(game->walls));
+  Maze_select();
+  Hash_pellets();
+}
+void Rank_add(const char *name, Uint32 score) {
+  Ranking *ranking = game->ranking;
+  Score record;
+  flock(ranking->fd, LOCK_EX);
+  Rank_sync();
+  Uint32 i = ranking->count;
+  memset(&record, 0, sizeof(record));
+  snprintf(record.name, sizeof(record.name), "%s", name);
+  record.score = score;
+  // at the end of what was read, over a record cut short by a crash if there is one
+  if (pwrite(ranking->fd, &record, sizeof(record), sizeof(struct RankHeader) + (off_t) i * sizeof(struct Score)) == sizeof(record)) {
+    Rank_grow(i + 1);
+    ranking->node[i].score = score;
+    ranking->node[i].size = 1;
+    ranking->node[i].left = RANK_NONE;
+    ranking->node[i].right = RANK_NONE;
+    ranking->count = i + 1;
+    Rank_insert(i);
+  }
+  else
+    printf("Cannot write file %s\n", ranking->path);
+  if (ranking->count - ranking->sorted > RANK_COMPACT && ranking->count - ranking->sorted > ranking->sorted / 8)
+    Rank_compact();
+  flock(ranking->fd, LOCK_UN);
+}
+Uint32 Rank_build(const Uint32 *ids, Uint32 lo, Uint32 hi) {
+  RankNode *node = game->ranking->node;
+  if (lo == hi)
+    return RANK_NONE;
+  Uint32 mid = lo + (hi - lo) / 2;
+  Uint32 i = (ids == NULL) ? mid : ids[mid];
+  node[i].left = Rank_build(ids, lo, mid);
+  node[i].right = Rank_build(ids, mid + 1, hi);
+  node[i].size = hi - lo;
+  return i;
+}
+void Rank_close() {
+  Ranking *ranking = game->ranking;
+  if (ranking == NULL)
+    return;
+  if (ranking->fd != -1)
+    close(ranking->fd);
+  free(ranking->node);
+  free(ranking->path);
+  free(ranking);
+  game->ranking = NULL;
+}
+void Rank_compact() {
+  Ranking *ranking = game->ranking;
+  RankHeader header;
+  struct stat st;
+  size_t size = sizeof(struct RankHeader) + (size_t) ranking->count * sizeof(struct Score);
+  int length = strlen(ranking->path) + 5;
+  char *tmp = (char *) malloc(length * sizeof(char));
+  snprintf(tmp, length, "%s.tmp", ranking->path);
+  char *base = (char *) mmap(NULL, size, PROT_READ, MAP_SHARED, ranking->fd, 0);
+  FILE *f = fopen(tmp, "wb");
+  if (base == MAP_FAILED || f == NULL) {
+    printf("Cannot open file %s\n", tmp);
+    if (base != MAP_FAILED)
+      munmap(base, size);
+    if (f != NULL)
+      fclose(f);
+    free(tmp);
+    return;
+  }
+  Score *record = (Score *) (base + sizeof(struct RankHeader));
+  Uint32 *ids = (Uint32 *) malloc(ranking->count * sizeof(Uint32));
+  Uint32 i = 0;
+  Rank_flatten(ranking->root, ids);
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, RANK_MAGIC, 8);
+  header.version = RANK_VERSION;
+  header.sorted = ranking->count;
+  fwrite(&header, sizeof(header), 1, f);
+  while (i < ranking->count)
+    fwrite(&record[ids[i++]], sizeof(struct Score), 1, f);
+  munmap(base, size);
+  int fd = -1;
+  // the log is replaced whole, the other instances notice the new file and read it again
+  if (fflush(f) != 0 || fsync(fileno(f)) != 0 || fclose(f) != 0 || rename(tmp, ranking->path) != 0 || (fd = open(ranking->path, O_RDWR)) == -1 || fstat(fd, &st) != 0) {
+    printf("Cannot write file %s\n", ranking->path);
+    if (fd != -1)
+      close(fd);
+    free(ids);
+    free(tmp);
+    return;
+  }
+  flock(fd, LOCK_EX);
+  close(ranking->fd);
+  ranking->fd = fd;
+  ranking->inode = st.st_ino;
+  // record i now holds the score of rank i
+  RankNode *node = (RankNode *) malloc(ranking->capacity * sizeof(struct RankNode));
+  i = 0;
+  while (i < ranking->count) {
+    node[i].score = ranking->node[ids[i]].score;
+    ++i;
+  }
+  free(ranking->node);
+  ranking->node = node;
+  ranking->sorted = ranking->count;
+  ranking->root = Rank_build(NULL, 0, ranking->count);
+  free(ids);
+  free(tmp);
+}
+Uint32 Rank_flatten(Uint32 i, Uint32 *ids) {
+  RankNode *node = game->ranking->node;
+  Uint32 stack[RANK_DEPTH], n = 0;
+  int top = 0;
+  while (i != RANK_NONE || top > 0) {
+    while (i != RANK_NONE) {
+      stack[top++] = i;
+      i = node[i].left;
     }
+    i = stack[--top];
+    ids[n++] = i;
+    i = node[i].right;
   }
-  else if (ghost->dir == DOWN && Ghost_moveDown(ghost) == 0) {
-    if (x >= ghost->x && ghost->ways[RIGHT] == 1 && Ghost_moveRight(ghost) == 1)
-      ghost->dir = RIGHT;
-    else if (ghost->ways[LEFT] == 1 && Ghost_moveLeft(ghost) == 1)
-      ghost->dir = LEFT;
-    else {
-      ghost->dir = RIGHT;
-      Ghost_moveRight(ghost);
+  return n;
+}
+void Rank_grow(Uint32 n) {
+  Ranking *ranking = game->ranking;
+  if (n <= ranking->capacity)
+    return;
+  ranking->capacity = n + n / 2 + 1024;
+  ranking->node = (RankNode *) realloc(ranking->node, ranking->capacity * sizeof(struct RankNode));
+}
+void Rank_insert(Uint32 i) {
+  RankNode *node = game->ranking->node;
+  Uint32 path[RANK_DEPTH], *link = &game->ranking->root, child = i;
+  int depth = 0;
+  // equal scores keep their age order, the new one goes after them
+  while (*link != RANK_NONE) {
+    path[depth++] = *link;
+    ++(node[*link].size);
+    link = (node[i].score > node[*link].score) ? &node[*link].left : &node[*link].right;
+  }
+  *link = i;
+  if (depth <= log(i + 1) / log(1.5))
+    return;
+  // too deep: somewhere up the path one side holds more than 2/3 of the nodes, rebuild there
+  while (depth > 0 && 3 * node[child].size <= 2 * node[path[depth - 1]].size)
+    child = path[--depth];
+  if (depth == 0)
+    return;
+  Uint32 top = path[depth - 1], n = node[top].size;
+  if (depth == 1)
+    link = &game->ranking->root;
+  else
+    link = (node[path[depth - 2]].left == top) ? &node[path[depth - 2]].left : &node[path[depth - 2]].right;
+  Uint32 *ids = (Uint32 *) malloc(n * sizeof(Uint32));
+  Rank_flatten(top, ids);
+  *link = Rank_build(ids, 0, n);
+  free(ids);
+}
+int Rank_load() {
+  Ranking *ranking = game->ranking;
+  RankHeader header;
+  struct stat st;
+  if (fstat(ranking->fd, &st) != 0)
+    return 0;
+  ranking->inode = st.st_ino;
+  ranking->count = 0;
+  ranking->root = RANK_NONE;
+  if (st.st_size == 0) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RANK_MAGIC, 8);
+    header.version = RANK_VERSION;
+    if (pwrite(ranking->fd, &header, sizeof(header), 0) != sizeof(header))
+      return 0;
+    st.st_size = sizeof(header);
+  }
+  if (pread(ranking->fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, RANK_MAGIC, 8) != 0 || header.version != RANK_VERSION) {
+    printf("Ignoring %s: built for another version of puckman\n", ranking->path);
+    return 0;
+  }
+  ranking->sorted = header.sorted;
+  Rank_read(st.st_size);
+  return 1;
+}
+Uint32 Rank_of(Uint32 score) {
+  RankNode *node = game->ranking->node;
+  Uint32 i = game->ranking->root, better = 0;
+  while (i != RANK_NONE)
+    if (node[i].score > score) {
+      better += ((node[i].left == RANK_NONE) ? 0 : node[node[i].left].size) + 1;
+      i = node[i].right;
     }
+    else
+      i = node[i].left;
+  return better + 1;
+}
+int Rank_open(const char *path) {
+  Ranking *ranking = (Ranking *) malloc(sizeof(struct Ranking));
+  int size = strlen(path) + 1;
+  ranking->node = NULL;
+  ranking->count = 0;
+  ranking->capacity = 0;
+  ranking->root = RANK_NONE;
+  ranking->sorted = 0;
+  ranking->path = (char *) malloc(size * sizeof(char));
+  snprintf(ranking->path, size, "%s", path);
+  game->ranking = ranking;
+  if ((ranking->fd = open(path, O_RDWR | O_CREAT, 0644)) == -1) {
+    printf("Cannot open file %s\n", path);
+    Rank_close();
+    return 0;
   }
-  else if (ghost->dir == RIGHT && Ghost_moveRight(ghost) == 0) {
-    if (y >= ghost->y && ghost->ways[DOWN] == 1 && Ghost_moveDown(ghost) == 1)
-      ghost->dir = DOWN;
-    else if (ghost->ways[UP] == 1 && Ghost_moveUp(ghost) == 1)
-      ghost->dir = UP;
-    else {
-      ghost->dir = DOWN;
-      Ghost_moveDown(ghost);
+  flock(ranking->fd, LOCK_EX);
+  int loaded = Rank_load();
+  flock(ranking->fd, LOCK_UN);
+  if (loaded == 0) {
+    Rank_close();
+    return 0;
+  }
+  return 1;
+}
+void Rank_read(off_t size) {
+  Ranking *ranking = game->ranking;
+  Score buffer[1024];
+  Uint32 n = (size - sizeof(struct RankHeader)) / sizeof(struct Score), i = ranking->count, j, k;
+  Rank_grow(n);
+  while (i < n) {
+    j = (n - i < 1024) ? n - i : 1024;
+    if (pread(ranking->fd, buffer, j * sizeof(struct Score), sizeof(struct RankHeader) + (off_t) i * sizeof(struct Score)) != (ssize_t) (j * sizeof(struct Score)))
+      break;
+    k = 0;
+    while (k < j) {
+      ranking->node[i + k].score = buffer[k].score;
+      ranking->node[i + k].size = 1;
+      ranking->node[i + k].left = RANK_NONE;
+      ranking->node[i + k].right = RANK_NONE;
+      ++k;
     }
+    i += j;
+  }
+  n = i;
+  i = ranking->count;
+  // sorted records make a balanced tree as they lie, the rest go in one by one
+  if (i == 0 && ranking->sorted > 0 && ranking->sorted <= n) {
+    ranking->root = Rank_build(NULL, 0, ranking->sorted);
+    i = ranking->sorted;
+  }
+  while (i < n) {
+    ranking->count = i + 1;
+    Rank_insert(i++);
+  }
+  ranking->count = n;
+}
+int Rank_run(Uint32 count, const char *path) {
+  RankHeader header;
+  Score record, view[11];
+  Uint32 i = 0, sum = 0;
+  FILE *f;
+  if ((f = fopen(path, "wb")) == NULL) {
+    printf("Cannot open file %s\n", path);
+    return 1;
   }
-  else if (ghost->dir == UP && Ghost_moveUp(ghost) == 0) {
-    if (x >= ghost->x && ghost->ways[RIGHT] == 1 && Ghost_moveRight(ghost) == 1)
-      ghost->dir = RIGHT;
-    else if (ghost->ways[LEFT] == 1 && Ghost_moveLeft(ghost) == 1)
-      ghost->dir = LEFT;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, RANK_MAGIC, 8);
+  header.version = RANK_VERSION;
+  fwrite(&header, sizeof(header), 1, f);
+  memset(&record, 0, sizeof(record));
+  while (i < count) {
+    snprintf(record.name, sizeof(record.name), "BENCH %u", i);
+    record.score = Hash_mix(1, i++) % 10000000;
+    fwrite(&record, sizeof(record), 1, f);
+  }
+  fclose(f);
+  game->bench = 1;
+  printf("entries %u\n", count);
+  Bench_mark(NULL);
+  if (Rank_open(path) == 0)
+    return 1;
+  Bench_mark("load_unsorted");
+  i = 0;
+  while (i < 1000000)
+    sum += Rank_of(Hash_mix(2, i++) % 10000000);
+  Bench_mark("rank_1000000");
+  i = 0;
+  while (i < 1000000 && count > 0)
+    sum += game->ranking->node[Rank_select(Hash_mix(3, i++) % count)].score;
+  Bench_mark("select_1000000");
+  Rank_view(view, 5000, 11);
+  Bench_mark("view_5000_5010");
+  Rank_compact();
+  Bench_mark("compact");
+  i = 0;
+  while (i < 1000)
+    Rank_add("BENCH", Hash_mix(4, i++) % 10000000);
+  Bench_mark("add_1000");
+  Rank_close();
+  Bench_mark(NULL);
+  if (Rank_open(path) == 0)
+    return 1;
+  Bench_mark("load_sorted");
+  Rank_view(view, 5000, 11);
+  printf("rank 5000 %s %u, rank of it %u (%u)\n", view[0].name, view[0].score, Rank_of(view[0].score), sum & 1);
+  Rank_close();
+  return 0;
+}
+Uint32 Rank_select(Uint32 k) {
+  RankNode *node = game->ranking->node;
+  Uint32 i = game->ranking->root, left;
+  while (i != RANK_NONE) {
+    left = (node[i].left == RANK_NONE) ? 0 : node[node[i].left].size;
+    if (k == left)
+      return i;
+    if (k < left)
+      i = node[i].left;
     else {
-      ghost->dir = RIGHT;
-      Ghost_moveRight(ghost);
+      k -= left + 1;
+      i = node[i].right;
     }
   }
+  return RANK_NONE;
 }
-void raiseWalls() {
-  int i = 1;
-  while (i < 46) {
-    game->walls[0][i] = -1;
-    game->walls[52][i++] = -1;
+void Rank_sync() {
+  Ranking *ranking = game->ranking;
+  struct stat st;
+  // another instance compacted the log into a new file, read that one
+  if (stat(ranking->path, &st) == 0 && st.st_ino != ranking->inode) {
+    int fd = open(ranking->path, O_RDWR);
+    if (fd == -1)
+      return;
+    flock(fd, LOCK_EX);
+    close(ranking->fd);
+    ranking->fd = fd;
+    if (Rank_load() == 0)
+      ranking->count = 0;
   }
-  i = 0;
-  while (i < 53) {
-    game->walls[i][0] = -1;
-    game->walls[i++][45] = -1;
+  else if (fstat(ranking->fd, &st) == 0 && st.st_size > (off_t) (sizeof(struct RankHeader) + (off_t) ranking->count * sizeof(struct Score)))
+    Rank_read(st.st_size);
+}
+void Rank_view(Score *scores, Uint32 first, Uint32 n) {
+  Ranking *ranking = game->ranking;
+  Uint32 i = 0, k;
+  while (i < n) {
+    k = (first + i > ranking->count) ? RANK_NONE : Rank_select(first + i - 1);
+    if (k == RANK_NONE || pread(ranking->fd, &scores[i], sizeof(struct Score), sizeof(struct RankHeader) + (off_t) k * sizeof(struct Score)) != sizeof(struct Score)) {
+      snprintf(scores[i].name, 20, "UNKNOWN            ");
+      scores[i].score = 0;
+    }
+    ++i;
   }
-  int j = 1;
-  while (j < 4) {
-    i = 1;
-    while (i < 22)
-      game->walls[j][i++] = 0;
-    while (i < 24)
-      game->walls[j][i++] = -1;
-    while (i < 45)
-      game->walls[j][i++] = 0;
-    ++j;
-  }
-  while (j < 7) {
-    i = 1;
-    while (i < 4)
-      game->walls[j][i++] = 0;
-    while (i < 9)
-      game->walls[j][i++] = -1;
-    while (i < 12)
-      game->walls[j][i++] = 0;
-    while (i < 19)
-      game->walls[j][i++] = -1;
-    while (i < 22)
-      game->walls[j][i++] = 0;
-    while (i < 24)
-      game->walls[j][i++] = -1;
-    while (i < 27)
-      game->walls[j][i++] = 0;
-    while (i < 34)
-      game->walls[j][i++] = -1;
-    while (i < 37)
-      game->walls[j][i++] = 0;
-    while (i < 42)
-      game->walls[j][i++] = -1;
-    while (i < 45)
-      game->walls[j][i++] = 0;
-    ++j;
-  }
-  j = 10; 
-  while (j < 12) {
-    i = 1;
-    while (i < 4)
-      game->walls[j][i++] = 0;
-    while (i < 9)
-      game->walls[j][i++] = -1;
-    while (i < 12)
-      game->walls[j][i++] = 0;
-    while (i < 14)
-      game->walls[j][i++] = -1;
-    while (i < 17)
-      game->walls[j][i++] = 0;
-    while (i < 29)
-      game->walls[j][i++] = -1;
-    while (i < 32)
-      game->walls[j][i++] = 0;
-    while (i < 34)
-      game->walls[j][i++] = -1;
-    while (i < 37)
-      game->walls[j][i++] = 0;
-    while (i < 42)
-      game->walls[j][i++] = -1;
-    while (i < 45)
-      game->walls[j][i++] = 0;
-    ++j;
-  }
-  while (j < 15) {
-    i = 1;
-    while (i < 12)
-      game->walls[j][i++] = 0;
-    while (i < 14)
-      game->walls[j][i++] = -1;
-    while (i < 22)
-      game->walls[j][i++] = 0;
-    while (i < 24)
-      game->walls[j][i++] = -1;
-    while (i < 32)
-      game->walls[j][i++] = 0;
-    while (i < 34)
-      game->walls[j][i++] = -1;
-    while (i < 45)
-      game->walls[j][i++] = 0;
-    ++j;
-  }
-  while (j < 17) {
-    i = 1;
-    while (i < 9)
-      game->walls[j][i++] = -1;
-    while (i < 12)
-      game->walls[j][i++] = 0;
-    while (i < 19)
-      game->walls[j][i++] = -1;
-    while (i < 22)
-      game->walls[j][i++] = 0;
-    while (i < 24)
-      game->walls[j][i++] = -1;
-    while (i < 27)
-      game->walls[j][i++] = 0;
-    while (i < 34)
-      game->walls[j][i++] = -1;
-    while (i < 37)
-      game->walls[j][i++] = 0;
-    while (i < 45)
-      game->walls[j][i++] = -1;
-    ++j;
-  }
-  while (j < 20) {
-    i = 8;
-    game->walls[j][i++] = -1;
-    while (i < 12)
-      game->walls[j][i++] = 0;
-    while (i < 14)
-      game->walls[j][i++] = -1;
-    while (i < 32)
-      game->walls[j][i++] = 0;
-    while (i < 34)
-      game->walls[j][i++] = -1;
-    while (i < 37)
-      game->walls[j][i++] = 0;
-    game->walls[j++][i] = -1;
-  }
-  i = 8;
-  game->walls[j][i++] = -1;
-  while (i < 12)
-    game->walls[j][i++] = 0;
-  while (i < 14)
-    game->walls[j][i++] = -1;
-  while (i < 17)
-    game->walls[j][i++] = 0;
-  while (i < 29)
-    game->walls[j][i++] = -1;
-  while (i < 32)
-    game->walls[j][i++] = 0;
-  while (i < 34)
-    game->walls[j][i++] = -1;
-  while (i < 37)
-    game->walls[j][i++] = 0;
-  game->walls[j++][i] = -1;
-  while (j < 23) {
-    i = 1;
-    while (i < 9)
-      game->walls[j][i++] = -1;
-    while (i < 12)
-      game->walls[j][i++] = 0;
-    while (i < 14)
-      game->walls[j][i++] = -1;
-    while (i < 17)
-      game->walls[j][i++] = 0;
-    game->walls[j][i++] = -1;
-    while (i < 28)
-      game->walls[j][i++] = 0;
-    game->walls[j][i++] = -1;
-    while (i < 32)
-      game->walls[j][i++] = 0;
-    while (i < 34)
-      game->walls[j][i++] = -1;
-    while (i < 37)
-      game->walls[j][i++] = 0;
-    while (i < 45)
-      game->walls[j][i++] = -1;
-    ++j;
-  }
-  while (j < 26) {
+}
+void Replay_close() {
+  Replay *replay = game->replay;
+  ReplayFooter footer;
+  if (replay->recording == 1) {
+    Replay_flush();
+    // the index lands on a 4-byte boundary so that it can be read in place
+    while (ftell(replay->file) % 4 != 0)
+      fputc(0, replay->file);
+    footer.index = ftell(replay->file);
+    footer.keys = replay->key_count;
+    footer.frames = replay->frames;
+    fwrite(replay->keys, sizeof(struct ReplayKey), replay->key_count, replay->file);
+    fwrite(&footer, sizeof(footer), 1, replay->file);
+    fclose(replay->file);
+    free(replay->keys);
+  }
+  else {
+    printf("score %d level %d state %d frames %u\n", game->score, game->level, game->state, replay->frames);
+    munmap(replay->map, replay->map_size);
+  }
+  free(replay);
+  game->replay = NULL;
+}
+void Replay_flush() {
+  Replay *replay = game->replay;
+  Uint32 left = replay->left;
+  if (left == 0)
+    return;
+  fputc(replay->run, replay->file);
+  while (left >= 128) {
+    fputc((left & 127) | 128, replay->file);
+    left >>= 7;
+  }
+  fputc(left, replay->file);
+  replay->left = 0;
+}
+int Replay_input() {
+  Replay *replay = game->replay;
+  int c;
+  if (replay == NULL)
+    return 0;
+  if (replay->recording == 1) {
+    c = game->pacman->nextDir | (replay->paused == 1 ? REPLAY_PAUSE : 0);
+    if (c != replay->run)
+      Replay_flush();
+    replay->run = c;
+    ++(replay->left);
+    game->paused ^= replay->paused;
+    replay->paused = 0;
+    if (++(replay->frames) % REPLAY_INTERVAL == 0)
+      Replay_key();
+    return 1;
+  }
+  if (replay->left == 0 && Replay_next() == 0)
+    return 0;
+  --(replay->left);
+  game->pacman->nextDir = replay->run & 3;
+  if (replay->run & REPLAY_PAUSE)
+    game->paused ^= 1;
+  ++(replay->frames);
+  return 1;
+}
+void Replay_key() {
+  Replay *replay = game->replay;
+  Snapshot snapshot;
+  Replay_flush();
+  if (replay->key_count == replay->key_size) {
+    replay->key_size = (replay->key_size == 0) ? 64 : replay->key_size * 2;
+    replay->keys = (ReplayKey *) realloc(replay->keys, replay->key_size * sizeof(struct ReplayKey));
+  }
+  replay->keys[replay->key_count].frame = replay->frames;
+  replay->keys[replay->key_count++].offset = ftell(replay->file);
+  memset(&snapshot, 0, sizeof(snapshot));
+  Snapshot_take(&snapshot);
+  fwrite(&snapshot, sizeof(snapshot), 1, replay->file);
+  // the input byte is never that, so the first frame after the keyframe starts a new run
+  replay->run = -1;
+}
+int Replay_next() {
+  Replay *replay = game->replay;
+  int shift = 0;
+  Uint8 b = 128;
+  while (replay->pos >= replay->end)
+    if (replay->segment > replay->key_count)
+      return 0;
+    else
+      Replay_segment(replay->segment);
+  replay->run = replay->map[replay->pos++];
+  replay->left = 0;
+  while ((b & 128) && replay->pos < replay->end && shift < 32) {
+    b = replay->map[replay->pos++];
+    replay->left |= (Uint32) (b & 127) << shift;
+    shift += 7;
+  }
+  return replay->left > 0;
+}
+int Replay_open(const char *path, int recording) {
+  ReplayHeader header;
+  ReplayFooter footer;
+  struct stat st;
+  Replay *replay;
+  Uint32 i;
+  int fd;
+  if (game->replay != NULL)
+    Replay_close();
+  if (recording == 1) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+      printf("Cannot open file %s\n", path);
+      return 0;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, REPLAY_MAGIC, 8);
+    header.version = REPLAY_VERSION;
+    header.mazes = game->maze_count;
+    header.interval = REPLAY_INTERVAL;
+    header.snapshot_size = sizeof(struct Snapshot);
+    fwrite(&header, sizeof(header), 1, f);
+    replay = (Replay *) malloc(sizeof(struct Replay));
+    replay->file = f;
+    replay->map = NULL;
+    replay->keys = NULL;
+    replay->key_count = 0;
+    replay->key_size = 0;
+  }
+  else {
+    if ((fd = open(path, O_RDONLY)) == -1) {
+      printf("Cannot open file %s\n", path);
+      return 0;
+    }
+    Uint8 *map = (fstat(fd, &st) == -1 || st.st_size < (off_t) (sizeof(header) + sizeof(footer))) ? (Uint8 *) MAP_FAILED : (Uint8 *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+      fprintf(stderr, "%s is not a replay\n", path);
+      return 0;
+    }
+    memcpy(&header, map, sizeof(header));
+    memcpy(&footer, map + st.st_size - sizeof(footer), sizeof(footer));
+    // the mazes rotate with the level, a replay only holds with the same set of them
+    if (memcmp(header.magic, REPLAY_MAGIC, 8) != 0 || header.version != REPLAY_VERSION || header.mazes != (Uint32) game->maze_count || header.snapshot_size != sizeof(struct Snapshot) || footer.index % 4 != 0 || footer.index > st.st_size - sizeof(footer) || (st.st_size - sizeof(footer) - footer.index) / sizeof(struct ReplayKey) != footer.keys) {
+      fprintf(stderr, "%s is not a replay of these mazes\n", path);
+      munmap(map, st.st_size);
+      return 0;
+    }
+    replay = (Replay *) malloc(sizeof(struct Replay));
+    replay->file = NULL;
+    replay->map = map;
+    replay->map_size = st.st_size;
+    replay->keys = (ReplayKey *) (map + footer.index);
+    replay->key_count = footer.keys;
+    replay->index = footer.index;
+    // each keyframe ahead of the last, its snapshot whole before the index
     i = 0;
-    while (i < 17)
-      game->walls[j][i++] = 0;
-    game->walls[j][i++] = -1;
-    while (i < 28)
-      game->walls[j][i++] = 0;
-    game->walls[j][i++] = -1;
-    while (i < 46)
-      game->walls[j][i++] = 0;
-    ++j;
-  }
-  while (j < 28) {
-    i = 1;
-    while (i < 9)
-      game->walls[j][i++] = -1;
-    while (i < 12)
-      game->walls[j][i++] = 0;
-    while (i < 14)
-      game->walls[j][i++] = -1;
-    while (i < 17)
-      game->walls[j][i++] = 0;
-    game->walls[j][i++] = -1;
-    while (i < 28)
-      game->walls[j][i++] = 0;
-    game->walls[j][i++] = -1;
-    while (i < 32)
-      game->walls[j][i++] = 0;
-    while (i < 34)
-      game->walls[j][i++] = -1;
-    while (i < 37)
-      game->walls[j][i++] = 0;
-    while (i < 45)
-      game->walls[j][i++] = -1;
-    ++j;
-  }
-  i = 8;
-  game->walls[j][i++] = -1;
-  while (i < 12)
-    game->walls[j][i++] = 0;
-  while (i < 14)
-    game->walls[j][i++] = -1;
-  while (i < 17)
-    game->walls[j][i++] = 0;
-  while (i < 29)
-    game->walls[j][i++] = -1;
-  while (i < 32)
-    game->walls[j][i++] = 0;
-  while (i < 34)
-    game->walls[j][i++] = -1;
-  while (i < 37)
-    game->walls[j][i++] = 0;
-  game->walls[j++][i] = -1;
-  while (j < 32) {
-    i = 8;
-    game->walls[j][i++] = -1;
-    while (i < 12)
-      game->walls[j][i++] = 0;
-    while (i < 14)
-      game->walls[j][i++] = -1;
-    while (i < 32)
-      game->walls[j][i++] = 0;
-    while (i < 34)
-      game->walls[j][i++] = -1;
-    while (i < 37)
-      game->walls[j][i++] = 0;
-    game->walls[j++][i] = -1;
-  }
-  while (j < 34) {
-    i = 1;
-    while (i < 9)
-      game->walls[j][i++] = -1;
-    while (i < 12)
-      game->walls[j][i++] = 0;
-    while (i < 14)
-      game->walls[j][i++] = -1;
-    while (i < 17)
-      game->walls[j][i++] = 0;
-    while (i < 29)
-      game->walls[j][i++] = -1;
-    while (i < 32)
-      game->walls[j][i++] = 0;
-    while (i < 34)
-      game->walls[j][i++] = -1;
-    while (i < 37)
-      game->walls[j][i++] = 0;
-    while (i < 45)
-      game->walls[j][i++] = -1;
-    ++j;
-  }
-  while (j < 37) {
-    i = 1;
-    while (i < 22)
-      game->walls[j][i++] = 0;
-    while (i < 24)
-      game->walls[j][i++] = -1;
-    ++j;
-  }
-  while (j < 39) {
-    i = 1;
-    while (i < 4)
-      game->walls[j][i++] = 0;
-    while (i < 9)
-      game->walls[j][i++] = -1;
-    while (i < 12)
-      game->walls[j][i++] = 0;
-    while (i < 19)
-      game->walls[j][i++] = -1;
-    while (i < 22)
-      game->walls[j][i++] = 0;
-    while (i < 24)
-      game->walls[j][i++] = -1;
-    while (i < 27)
-      game->walls[j][i++] = 0;
-    while (i < 34)
-      game->walls[j][i++] = -1;
-    while (i < 37)
-      game->walls[j][i++] = 0;
-    while (i < 42)
-      game->walls[j][i++] = -1;
-    ++j;
-  }
-  while (j < 42) {
-    i = 1;
-    while (i < 7)
-      game->walls[j][i++] = 0;
-    while (i < 9)
-      game->walls[j][i++] = -1;
-    while (i < 37)
-      game->walls[j][i++] = 0;
-    while (i < 39)
-      game->walls[j][i++] = -1;
-    while (i < 45)
-      game->walls[j][i++] = 0;
-    ++j;
-  }
-  while (j < 44) {
-    i = 1;
-    while (i < 4)
-      game->walls[j][i++] = -1;
-    while (i < 7)
-      game->walls[j][i++] = 0;
-    while (i < 9)
-      game->walls[j][i++] = -1;
-    while (i < 12)
-      game->walls[j][i++] = 0;
-    while (i < 14)
-      game->walls[j][i++] = -1;
-    while (i < 17)
-      game->walls[j][i++] = 0;
-    while (i < 29)
-      game->walls[j][i++] = -1;
-    while (i < 32)
-      game->walls[j][i++] = 0;
-    while (i < 34)
-      game->walls[j][i++] = -1;
-    while (i < 37)
-      game->walls[j][i++] = 0;
-    while (i < 39)
-      game->walls[j][i++] = -1;
-    while (i < 42)
-      game->walls[j][i++] = 0;
-    while (i < 45)
-      game->walls[j][i++] = -1;
-    ++j;
-  }
-  while (j < 47) {
-    i = 1;
-    while (i < 12)
-      game->walls[j][i++] = 0;
-    while (i < 14)
-      game->walls[j][i++] = -1;
-    while (i < 22)
-      game->walls[j][i++] = 0;
-    while (i < 24)
-      game->walls[j][i++] = -1;
-    while (i < 32)
-      game->walls[j][i++] = 0;
-    while (i < 34)
-      game->walls[j][i++] = -1;
-    ++j;
-  }
-  while (j < 49) {
-    i = 1;
-    while (i < 4)
-      game->walls[j][i++] = 0;
-    while (i < 19)
-      game->walls[j][i++] = -1;
-    while (i < 22)
-      game->walls[j][i++] = 0;
-    while (i < 24)
-      game->walls[j][i++] = -1;
-    while (i < 27)
-      game->walls[j][i++] = 0;
-    while (i < 42)
-      game->walls[j][i++] = -1;
-    ++j;
-  }
-  game->walls[2][2] = 1;
-  game->walls[2][4] = 1;
-  game->walls[2][5] = 1;
-  game->walls[2][7] = 1;
-  game->walls[2][8] = 1;
-  game->walls[2][10] = 1;
-  game->walls[2][12] = 1;
-  game->walls[2][13] = 1;
-  game->walls[2][15] = 1;
-  game->walls[2][17] = 1;
-  game->walls[2][18] = 1;
-  game->walls[2][20] = 1;
-  game->walls[2][25] = 1;
-  game->walls[2][27] = 1;
-  game->walls[2][28] = 1;
-  game->walls[2][30] = 1;
-  game->walls[2][31] = 1;
-  game->walls[2][33] = 1;
-  game->walls[2][35] = 1;
-  game->walls[2][37] = 1;
-  game->walls[2][38] = 1;
-  game->walls[2][40] = 1;
-  game->walls[2][41] = 1;
-  game->walls[2][43] = 1;
-  i = 4;
-  while (i < 7) {
-    game->walls[i][2] = 1;
-    game->walls[i][10] = 1;
-    game->walls[i][20] = 1;
-    game->walls[i][25] = 1;
-    game->walls[i][35] = 1;
-    game->walls[i++][43] = 1;
-  }
-  game->walls[8][2] = 1;
-  game->walls[8][4] = 1;
-  game->walls[8][5] = 1;
-  game->walls[8][7] = 1;
-  game->walls[8][8] = 1;
-  game->walls[8][10] = 1;
-  game->walls[8][12] = 1;
-  game->walls[8][13] = 1;
-  game->walls[8][15] = 1;
-  game->walls[8][17] = 1;
-  game->walls[8][18] = 1;
-  game->walls[8][20] = 1;
-  game->walls[8][22] = 1;
-  game->walls[8][23] = 1;
-  game->walls[8][25] = 1;
-  game->walls[8][27] = 1;
-  game->walls[8][28] = 1;
-  game->walls[8][30] = 1;
-  game->walls[8][31] = 1;
-  game->walls[8][33] = 1;
-  game->walls[8][35] = 1;
-  game->walls[8][37] = 1;
-  game->walls[8][38] = 1;
-  game->walls[8][40] = 1;
-  game->walls[8][41] = 1;
-  game->walls[8][43] = 1;
-  i = 10;
-  while (i < 12) {
-    game->walls[i][2] = 1;
-    game->walls[i][10] = 1;
-    game->walls[i][15] = 1;
-    game->walls[i][30] = 1;
-    game->walls[i][35] = 1;
-    game->walls[i++][43] = 1;
-  }
-  game->walls[13][2] = 1;
-  game->walls[13][4] = 1;
-  game->walls[13][5] = 1;
-  game->walls[13][7] = 1;
-  game->walls[13][8] = 1;
-  game->walls[13][10] = 1;
-  game->walls[13][15] = 1;
-  game->walls[13][17] = 1;
-  game->walls[13][18] = 1;
-  game->walls[13][20] = 1;
-  game->walls[13][25] = 1;
-  game->walls[13][27] = 1;
-  game->walls[13][28] = 1;
-  game->walls[13][30] = 1;
-  game->walls[13][35] = 1;
-  game->walls[13][37] = 1;
-  game->walls[13][38] = 1;
-  game->walls[13][40] = 1;
-  game->walls[13][41] = 1;
-  game->walls[13][43] = 1;
-  i = 15;
-  while (i < 34) {
-    game->walls[i][10] = 1;
-    game->walls[i++][35] = 1;
-    if (i == 17 || i == 19 || i == 23 || i == 25 || i == 29 || i == 31)
+    while (i < replay->key_count && replay->keys[i].offset >= ((i == 0) ? sizeof(header) : replay->keys[i - 1].offset + sizeof(struct Snapshot)) && replay->keys[i].offset <= footer.index && footer.index - replay->keys[i].offset >= sizeof(struct Snapshot) && (i == 0 || replay->keys[i].frame > replay->keys[i - 1].frame))
       ++i;
-  }
-  game->walls[35][2] = 1;
-  game->walls[35][4] = 1;
-  game->walls[35][5] = 1;
-  game->walls[35][7] = 1;
-  game->walls[35][8] = 1;
-  game->walls[35][10] = 1;
-  game->walls[35][12] = 1;
-  game->walls[35][13] = 1;
-  game->walls[35][15] = 1;
-  game->walls[35][17] = 1;
-  game->walls[35][18] = 1;
-  game->walls[35][20] = 1;
-  game->walls[35][25] = 1;
-  game->walls[35][27] = 1;
-  game->walls[35][28] = 1;
-  game->walls[35][30] = 1;
-  game->walls[35][31] = 1;
-  game->walls[35][33] = 1;
-  game->walls[35][35] = 1;
-  game->walls[35][37] = 1;
-  game->walls[35][38] = 1;
-  game->walls[35][40] = 1;
-  game->walls[35][41] = 1;
-  game->walls[35][43] = 1;
-  i = 37;
-  while (i < 39) {
-    game->walls[i][2] = 1;
-    game->walls[i][10] = 1;
-    game->walls[i][20] = 1;
-    game->walls[i][25] = 1;
-    game->walls[i][35] = 1;
-    game->walls[i++][43] = 1;
-  }
-  game->walls[40][2] = 1;
-  game->walls[40][4] = 1;
-  game->walls[40][5] = 1;
-  game->walls[40][10] = 1;
-  game->walls[40][12] = 1;
-  game->walls[40][13] = 1;
-  game->walls[40][15] = 1;
-  game->walls[40][17] = 1;
-  game->walls[40][18] = 1;
-  game->walls[40][20] = 1;
-  game->walls[40][25] = 1;
-  game->walls[40][27] = 1;
-  game->walls[40][28] = 1;
-  game->walls[40][30] = 1;
-  game->walls[40][31] = 1;
-  game->walls[40][33] = 1;
-  game->walls[40][35] = 1;
-  game->walls[40][40] = 1;
-  game->walls[40][41] = 1;
-  game->walls[40][43] = 1;
-  i = 42;
-  while (i < 44) {
-    game->walls[i][5] = 1;
-    game->walls[i][10] = 1;
-    game->walls[i][15] = 1;
-    game->walls[i][30] = 1;
-    game->walls[i][35] = 1;
-    game->walls[i++][40] = 1;
-  }
-  game->walls[45][2] = 1;
-  game->walls[45][4] = 1;
-  game->walls[45][5] = 1;
-  game->walls[45][7] = 1;
-  game->walls[45][8] = 1;
-  game->walls[45][10] = 1;
-  game->walls[45][15] = 1;
-  game->walls[45][17] = 1;
-  game->walls[45][18] = 1;
-  game->walls[45][20] = 1;
-  game->walls[45][25] = 1;
-  game->walls[45][27] = 1;
-  game->walls[45][28] = 1;
-  game->walls[45][30] = 1;
-  game->walls[45][35] = 1;
-  game->walls[45][37] = 1;
-  game->walls[45][38] = 1;
-  game->walls[45][40] = 1;
-  game->walls[45][41] = 1;
-  game->walls[45][43] = 1;
-  i = 47;
-  while (i < 49) {
-    game->walls[i][2] = 1;
-    game->walls[i][20] = 1;
-    game->walls[i][25] = 1;
-    game->walls[i++][43] = 1;
-  }
-  game->walls[50][2] = 1;
-  game->walls[50][4] = 1;
-  game->walls[50][5] = 1;
-  game->walls[50][7] = 1;
-  game->walls[50][8] = 1;
-  game->walls[50][10] = 1;
-  game->walls[50][12] = 1;
-  game->walls[50][13] = 1;
-  game->walls[50][15] = 1;
-  game->walls[50][17] = 1;
-  game->walls[50][18] = 1;
-  game->walls[50][20] = 1;
-  game->walls[50][22] = 1;
-  game->walls[50][23] = 1;
-  game->walls[50][25] = 1;
-  game->walls[50][27] = 1;
-  game->walls[50][28] = 1;
-  game->walls[50][30] = 1;
-  game->walls[50][31] = 1;
-  game->walls[50][33] = 1;
-  game->walls[50][35] = 1;
-  game->walls[50][37] = 1;
-  game->walls[50][38] = 1;
-  game->walls[50][40] = 1;
-  game->walls[50][41] = 1;
-  game->walls[50][43] = 1;
-}
-void sort() {
-  int unsorted = 1, i;
-  while (unsorted) {
-    unsorted = 0;
-    i = 10;
-    while (i > 0) {
-      if (toInt(game->highscores[1][i]) > toInt(game->highscores[1][i - 1])) {
-	swap(i);
-	unsorted = 1;
-      }
-      --i;
+    if (i < replay->key_count) {
+      fprintf(stderr, "%s has a broken keyframe index\n", path);
+      munmap(map, st.st_size);
+      free(replay);
+      return 0;
     }
   }
-  writeScores();
+  replay->recording = recording;
+  replay->paused = 0;
+  replay->frames = 0;
+  replay->run = -1;
+  replay->left = 0;
+  game->replay = replay;
+  if (recording == 0)
+    Replay_segment(0);
+  return 1;
+}
+int Replay_run(const char *path, Uint32 frame) {
+  // every frame from the start, as it was played, never from a keyframe
+  if (Replay_open(path, 0) == 0)
+    return 1;
+  game->headless = 1;
+  Game_new();
+  Hash_write();
+  while (game->replay->frames < frame && Replay_input() == 1) {
+    Game_advance();
+    Game_step();
+    Hash_write();
+  }
+  Replay_close();
+  return 0;
+}
+int Replay_seek(Uint32 frame) {
+  Replay *replay = game->replay;
+  Uint32 low = 0, high = replay->key_count, middle;
+  Snapshot snapshot;
+  int headless = game->headless, pending = 0, more = 1;
+  // last keyframe up to frame, then the frames from there on; from where it stands without one further,
+  // from the start without one behind. The step of the frame reached is left to the main loop, which
+  // starts each of its turns with one
+  while (low < high) {
+    middle = (low + high) / 2;
+    if (replay->keys[middle].frame <= frame)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  game->headless = 1;
+  if (low > 0 && (replay->keys[low - 1].frame > replay->frames || frame < replay->frames)) {
+    // the mapping only guarantees the alignment of the file
+    memcpy(&snapshot, replay->map + replay->keys[low - 1].offset, sizeof(snapshot));
+    Snapshot_restore(&snapshot);
+    Replay_segment(low);
+    replay->frames = replay->keys[low - 1].frame;
+    replay->left = 0;
+    Game_advance();
+    pending = 1;
+  }
+  else if (frame < replay->frames) {
+    Game_new();
+    Replay_segment(0);
+    replay->frames = 0;
+    replay->left = 0;
+  }
+  while (replay->frames < frame && more == 1) {
+    if (pending == 1)
+      Game_step();
+    if ((more = Replay_input()) == 1)
+      Game_advance();
+    pending = more;
+  }
+  game->headless = headless;
+  return replay->frames == frame;
+}
+void Replay_segment(Uint32 k) {
+  Replay *replay = game->replay;
+  replay->pos = (k == 0) ? sizeof(struct ReplayHeader) : replay->keys[k - 1].offset + sizeof(struct Snapshot);
+  replay->end = (k < replay->key_count) ? replay->keys[k].offset : replay->index;
+  replay->segment = k + 1;
 }
-void swap(int i) {
-  char temp[2][20];
-  snprintf(temp[0], 20, "%s", game->highscores[0][i]);
-  snprintf(temp[1], 20, "%s", game->highscores[1][i]);
-  snprintf(game->highscores[0][i], 20, "%s", game->highscores[0][i - 1]);
-  snprintf(game->highscores[1][i], 20, "%s", game->highscores[1][i - 1]);
-  snprintf(game->highscores[0][i - 1], 20, "%s", temp[0]);
-  snprintf(game->highscores[1][i - 1], 20, "%s", temp[1]);
+Uint32 Score_checksum(const Score *scores) {
+  const Uint8 *c = (const Uint8 *) scores;
+  Uint32 h = 2166136261u;
+  unsigned int i = 0;
+  while (i < SCORES * sizeof(struct Score))
+    h = (h ^ c[i++]) * 16777619u;
+  return h;
+}
+void Score_load() {
+  ScoreHeader header;
+  int i = 0, valid = 0;
+  FILE *f = fopen(game->scores_file, "rb");
+  if (f != NULL) {
+    valid = fread(&header, sizeof(header), 1, f) == 1 && memcmp(header.magic, SCORE_MAGIC, 8) == 0 && header.version == SCORE_VERSION && header.entries == SCORES && fread(game->scores, sizeof(struct Score), SCORES, f) == SCORES && header.checksum == Score_checksum(game->scores);
+    fclose(f);
+    if (valid == 1)
+      return;
+    // set aside rather than written over, the scores in it may still be recovered by hand
+    int length = strlen(game->scores_file) + 5;
+    char *bad = (char *) malloc(length * sizeof(char));
+    snprintf(bad, length, "%s.bad", game->scores_file);
+    if (rename(game->scores_file, bad) == 0)
+      fprintf(stderr, "Ignoring %s: damaged or built for another version of puckman, kept as %s\n", game->scores_file, bad);
+    else
+      fprintf(stderr, "Ignoring %s: damaged or built for another version of puckman\n", game->scores_file);
+    free(bad);
+  }
+  while (i < SCORES) {
+    snprintf(game->scores[i].name, 20, "UNKNOWN            ");
+    game->scores[i++].score = 0;
+  }
+  // the text table of older versions, 40-byte lines of name:score
+  int size = strlen(getenv("HOME")) + 25;
+  char *path = (char *) malloc(size * sizeof(char));
+  char line[42];
+  snprintf(path, size, "%s/.puckman/highscores.txt", getenv("HOME"));
+  i = 0;
+  if ((f = fopen(path, "r")) != NULL) {
+    while (i < SCORES && fgets(line, sizeof(line), f) != NULL && strlen(line) > 20 && line[19] == ':') {
+      memcpy(game->scores[i].name, line, 19);
+      game->scores[i].name[19] = '\0';
+      game->scores[i++].score = strtoul(line + 20, NULL, 10);
+    }
+    fclose(f);
+  }
+  free(path);
+  Score_write(game->scores);
 }
-int toInt(char score[20]) {
-  int i = 0, r = 0, j = 0;
-  while (i < 20) {
-    if (score[19 - i] > 47 && score[19 - i] < 58)
-      r += (score[19 - i] - 48) * (int) pow(10, j++);
+void Score_post(const Score *batch, int n) {
+  Score scores[SCORES];
+  int i = 0, j;
+  // the lock keeps other writers out the whole time, readers only retry while the table is copied in
+  if (game->board_fd != -1)
+    flock(game->board_fd, LOCK_EX);
+  memcpy(scores, game->board->scores, sizeof(scores));
+  // the table is the top of the ranking, or kept by itself when there is none
+  if (game->ranking != NULL) {
+    while (i < n) {
+      Rank_add(batch[i].name, batch[i].score);
+      ++i;
+    }
+    fdatasync(game->ranking->fd);
+    Rank_view(scores, 1, SCORES);
+  }
+  while (game->ranking == NULL && i < n) {
+    j = 0;
+    // below the scores it equals, the last one falls off
+    while (j < SCORES && scores[j].score >= batch[i].score)
+      ++j;
+    if (j < SCORES) {
+      memmove(&scores[j + 1], &scores[j], (SCORES - 1 - j) * sizeof(struct Score));
+      scores[j] = batch[i];
+    }
     ++i;
   }
-  return r;
+  Board_begin();
+  memcpy(game->board->scores, scores, sizeof(scores));
+  Board_end();
+  if (game->board_fd != -1)
+    flock(game->board_fd, LOCK_UN);
 }
-void writeScores() {
-  FILE *f;
-  if ((f = fopen(game->scores_file, "w")) == NULL) {
-    printf("Cannot open file %s\n", game->scores_file);
+void Score_write(const Score *scores) {
+  ScoreHeader header;
+  int size = strlen(game->scores_file) + 5, fd;
+  char *tmp = (char *) malloc(size * sizeof(char)), *slash;
+  snprintf(tmp, size, "%s.tmp", game->scores_file);
+  FILE *f = fopen(tmp, "wb");
+  if (f == NULL) {
+    printf("Cannot open file %s\n", tmp);
+    free(tmp);
     return;
   }
-  char *str = (char *) malloc(41 * sizeof(char));
-  int i = 0;
-  while (i < 10) {
-    snprintf(str, 41, "%s:%s\n", game->highscores[0][i], game->highscores[1][i]);
-    fwrite(str, sizeof(char), 40, f);
-    ++i;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SCORE_MAGIC, 8);
+  header.version = SCORE_VERSION;
+  header.entries = SCORES;
+  header.checksum = Score_checksum(scores);
+  // the new table is complete on disk before it takes the place of the old one
+  if (fwrite(&header, sizeof(header), 1, f) != 1 || fwrite(scores, sizeof(struct Score), SCORES, f) != SCORES || fflush(f) != 0 || fsync(fileno(f)) != 0) {
+    printf("Cannot write file %s\n", tmp);
+    fclose(f);
+    remove(tmp);
   }
-  free(str);
+  else if (fclose(f) != 0 || rename(tmp, game->scores_file) != 0)
+    printf("Cannot write file %s\n", game->scores_file);
+  else if ((slash = strrchr(tmp, '/')) != NULL) {
+    // the rename is only there after a crash once the directory holding it is on disk too
+    *slash = '\0';
+    if ((fd = open(tmp, O_RDONLY)) != -1) {
+      fsync(fd);
+      close(fd);
+    }
+  }
+  free(tmp);
+}
+void Snapshot_load(const char *path) {
+  SaveHeader header;
+  Snapshot snapshot;
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    printf("Cannot open file %s\n", path);
+    return;
+  }
+  if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, SAVE_MAGIC, 8) != 0 || header.version != SAVE_VERSION || header.mazes != (Uint32) game->maze_count || header.snapshot_size != sizeof(struct Snapshot) || fread(&snapshot, sizeof(snapshot), 1, f) != 1)
+    fprintf(stderr, "%s is not a saved game of these mazes\n", path);
+  else {
+    // the game goes on from elsewhere, what was recorded so far no longer leads here
+    if (game->replay != NULL)
+      Replay_close();
+    Snapshot_restore(&snapshot);
+  }
+  fclose(f);
+}
+void Snapshot_restore(const Snapshot *snapshot) {
+  game->frame = snapshot->frame;
+  game->ticks = snapshot->ticks;
+  game->ticks_fruit = snapshot->ticks_fruit;
+  game->score = snapshot->score;
+  game->lives = snapshot->lives;
+  game->level = snapshot->level;
+  game->state = snapshot->state;
+  game->bonus = snapshot->bonus;
+  game->newlife = snapshot->newlife;
+  game->paused = snapshot->paused;
+  game->fruit = snapshot->fruit;
+  game->delay = snapshot->delay;
+  game->candy_blow_delay = snapshot->candy_blow_delay;
+  memcpy(game->walls, snapshot->walls, sizeof(game->walls));
+  Hash_pellets();
+  memcpy(game->pacman, snapshot->pacman, sizeof(snapshot->pacman));
+  memcpy(game->ghosts, snapshot->ghosts, sizeof(snapshot->ghosts));
+  memcpy(game->collision, &snapshot->collision, sizeof(struct Collision));
+  // only look the maze up again when the level moves to another one
+  if (game->maze != &game->mazes[(game->level + game->maze_count - 1) % game->maze_count])
+    Maze_select();
+  else
+    game->chase_tile = -1;
+}
+void Snapshot_save(const char *path) {
+  SaveHeader header;
+  Snapshot snapshot;
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) {
+    printf("Cannot open file %s\n", path);
+    return;
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SAVE_MAGIC, 8);
+  header.version = SAVE_VERSION;
+  header.mazes = game->maze_count;
+  header.snapshot_size = sizeof(struct Snapshot);
+  memset(&snapshot, 0, sizeof(snapshot));
+  Snapshot_take(&snapshot);
+  fwrite(&header, sizeof(header), 1, f);
+  fwrite(&snapshot, sizeof(snapshot), 1, f);
   fclose(f);
 }
+void Snapshot_take(Snapshot *snapshot) {
+  snapshot->frame = game->frame;
+  snapshot->ticks = game->ticks;
+  snapshot->ticks_fruit = game->ticks_fruit;
+  snapshot->score = game->score;
+  snapshot->lives = game->lives;
+  snapshot->level = game->level;
+  snapshot->state = game->state;
+  snapshot->bonus = game->bonus;
+  snapshot->newlife = game->newlife;
+  snapshot->paused = game->paused;
+  snapshot->fruit = game->fruit;
+  snapshot->delay = game->delay;
+  snapshot->candy_blow_delay = game->candy_blow_delay;
+  memcpy(snapshot->walls, game->walls, sizeof(snapshot->walls));
+  memcpy(snapshot->pacman, game->pacman, sizeof(snapshot->pacman));
+  memcpy(snapshot->ghosts, game->ghosts, sizeof(snapshot->ghosts));
+  memcpy(&snapshot->collision, game->collision, sizeof(struct Collision));
+}
+void Writer_post(const char *name, Uint32 score) {
+  Writer *writer = game->writer;
+  SDL_LockMutex(writer->lock);
+  if (writer->count < WRITER_QUEUE) {
+    snprintf(writer->pending[writer->count].name, sizeof(writer->pending[0].name), "%s", name);
+    writer->pending[writer->count++].score = score;
+    SDL_CondSignal(writer->wake);
+  }
+  else
+    fprintf(stderr, "Too many high scores waiting to be written, dropping %u\n", score);
+  SDL_UnlockMutex(writer->lock);
+}
+int Writer_run(void *data) {
+  Writer *writer = (Writer *) data;
+  Score batch[WRITER_QUEUE];
+  int n, persist;
+  SDL_LockMutex(writer->lock);
+  // once stopped, what was posted still gets written before the thread ends
+  while (writer->running == 1 || writer->count > 0 || writer->persist == 1) {
+    if (writer->count == 0 && writer->persist == 0)
+      SDL_CondWait(writer->wake, writer->lock);
+    else {
+      n = writer->count;
+      memcpy(batch, writer->pending, n * sizeof(struct Score));
+      persist = writer->persist;
+      writer->count = 0;
+      writer->persist = 0;
+      SDL_UnlockMutex(writer->lock);
+      if (n > 0)
+        Score_post(batch, n);
+      if (persist == 1)
+        Board_save();
+      SDL_LockMutex(writer->lock);
+    }
+  }
+  SDL_UnlockMutex(writer->lock);
+  return 0;
+}
+void Writer_start() {
+  Writer *writer = (Writer *) malloc(sizeof(struct Writer));
+  writer->count = 0;
+  writer->persist = 0;
+  writer->running = 1;
+  writer->lock = SDL_CreateMutex();
+  writer->wake = SDL_CreateCond();
+  writer->thread = SDL_CreateThread(Writer_run, writer);
+  game->writer = writer;
+}
+void Writer_stop() {
+  Writer *writer = game->writer;
+  if (writer == NULL)
+    return;
+  SDL_LockMutex(writer->lock);
+  writer->running = 0;
+  SDL_CondSignal(writer->wake);
+  SDL_UnlockMutex(writer->lock);
+  SDL_WaitThread(writer->thread, NULL);
+  SDL_DestroyCond(writer->wake);
+  SDL_DestroyMutex(writer->lock);
+  free(writer);
+  game->writer = NULL;
+}